@@ -0,0 +1,48 @@
+#include "alloc_counter.h"
+#include <cstdlib>
+#include <new>
+
+// Replace the global operator new with one that counts calls per thread.
+// Counting is a thread local increment, cheap enough to leave on
+namespace
+{
+thread_local unsigned long long num_alloc = 0;
+
+void* counted_alloc(std::size_t size)
+{
+    ++num_alloc;
+    void* ptr = std::malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr) throw std::bad_alloc();
+    return ptr;
+}
+}
+
+namespace alloc_counter
+{
+unsigned long long thread_count() { return num_alloc; }
+}
+
+void* operator new(std::size_t size) { return counted_alloc(size); }
+void* operator new[](std::size_t size) { return counted_alloc(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    ++num_alloc;
+    return std::malloc(size == 0 ? 1 : size);
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    ++num_alloc;
+    return std::malloc(size == 0 ? 1 : size);
+}
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+    std::free(ptr);
+}
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+    std::free(ptr);
+}
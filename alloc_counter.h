@@ -0,0 +1,11 @@
+#ifndef PROCESS_ALLOC_COUNTER_H
+#define PROCESS_ALLOC_COUNTER_H
+
+// Number of times the calling thread went through operator new. Used to check
+// that the insert loops stay free of per cell allocations
+namespace alloc_counter
+{
+unsigned long long thread_count();
+}
+
+#endif // PROCESS_ALLOC_COUNTER_H
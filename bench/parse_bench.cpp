@@ -0,0 +1,150 @@
+// Time the number parsers of misc against what they replaced: convert<T>
+// through an istringstream, the unchecked string_to_int, and strtod/strtoll
+// as used by parse_int and parse_double before. The input mimics phenotype
+// cells: small integers, codes and decimals with a few digits
+#include "misc.hpp"
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+// convert<T> before read_int and read_double
+template <typename T> T baseline_convert(const std::string& str)
+{
+    std::istringstream iss(str);
+    T obj;
+    iss >> obj;
+
+    if (!iss.eof() || iss.fail())
+    { throw std::runtime_error("Unable to convert the input"); }
+    return obj;
+}
+
+// string_to_int before it went through convert
+int baseline_string_to_int(const char* p)
+{
+    int x = 0;
+    bool neg = false;
+    if (*p == '-')
+    {
+        neg = true;
+        ++p;
+    }
+    else if (*p == '+')
+    {
+        ++p;
+    }
+    else if (*p < '0' || *p > '9')
+    {
+        throw std::runtime_error("Error: Not an integer\n");
+    }
+    while (*p >= '0' && *p <= '9')
+    {
+        x = (x * 10) + (*p - '0');
+        ++p;
+    }
+    if (neg) { x = -x; }
+    return x;
+}
+
+// parse_double and parse_int before, strtod and strtoll on a copy
+bool baseline_parse_double(const misc::string_view& str, double& value)
+{
+    const std::string copy = str.to_string();
+    char* end = nullptr;
+    value = strtod(copy.c_str(), &end);
+    return !copy.empty() && *end == '\0';
+}
+
+bool baseline_parse_int(const misc::string_view& str, long long& value)
+{
+    const std::string copy = str.to_string();
+    char* end = nullptr;
+    value = strtoll(copy.c_str(), &end, 10);
+    return !copy.empty() && *end == '\0';
+}
+
+template <typename Parse>
+void run(const char* name, const std::vector<std::string>& cells,
+         Parse parse)
+{
+    // keeps the compiler from dropping the loop
+    double sum = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (auto&& cell : cells) sum += parse(cell);
+    const double ns = std::chrono::duration<double, std::nano>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+    printf("  %-28s %8.1f ns/cell  (%g)\n", name,
+           ns / static_cast<double>(cells.size()), sum);
+}
+}
+
+int main()
+{
+    const size_t num_cell = 2000000;
+    std::mt19937_64 rng(42);
+    std::vector<std::string> integers, decimals;
+    for (size_t i = 0; i < num_cell; ++i)
+    {
+        // codes, counts and 7 digit participant IDs
+        switch (rng() % 3)
+        {
+        case 0: integers.push_back(std::to_string(rng() % 10)); break;
+        case 1:
+            integers.push_back(std::to_string(static_cast<int>(rng() % 2000)
+                                              - 1000));
+            break;
+        default:
+            integers.push_back(std::to_string(1000000 + rng() % 9000000));
+        }
+        char text[32];
+        snprintf(text, sizeof(text), "%.*f", static_cast<int>(rng() % 5),
+                 static_cast<double>(rng() % 200000) / 100.0 - 100.0);
+        decimals.push_back(text);
+    }
+    printf("%zu integer and %zu decimal cells\n", num_cell, num_cell);
+    printf("Integers\n");
+    run("baseline convert<int>", integers, [](const std::string& s) {
+        return baseline_convert<int>(s);
+    });
+    run("convert<int>", integers,
+        [](const std::string& s) { return misc::convert<int>(s); });
+    run("baseline string_to_int", integers, [](const std::string& s) {
+        return baseline_string_to_int(s.c_str());
+    });
+    run("string_to_int", integers, [](const std::string& s) {
+        return misc::string_to_int(s.c_str());
+    });
+    run("strtoll", integers, [](const std::string& s) {
+        long long value = 0;
+        baseline_parse_int(misc::string_view(s), value);
+        return static_cast<double>(value);
+    });
+    run("parse_int", integers, [](const std::string& s) {
+        long long value = 0;
+        misc::parse_int(misc::string_view(s), value);
+        return static_cast<double>(value);
+    });
+    printf("Decimals\n");
+    run("baseline convert<double>", decimals, [](const std::string& s) {
+        return baseline_convert<double>(s);
+    });
+    run("convert<double>", decimals,
+        [](const std::string& s) { return misc::convert<double>(s); });
+    run("strtod", decimals, [](const std::string& s) {
+        double value = 0;
+        baseline_parse_double(misc::string_view(s), value);
+        return value;
+    });
+    run("parse_double", decimals, [](const std::string& s) {
+        double value = 0;
+        misc::parse_double(misc::string_view(s), value);
+        return value;
+    });
+    return 0;
+}
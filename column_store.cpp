@@ -0,0 +1,265 @@
+#include "column_store.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <zlib.h>
+
+namespace
+{
+const char magic[8] = {'U', 'K', 'B', 'C', 'O', 'L', '1', '\n'};
+
+template <typename T>
+void put(std::vector<char>& out, size_t pos, const T& value)
+{
+    memcpy(out.data() + pos, &value, sizeof(T));
+}
+
+const char* type_name(int type)
+{
+    static const char* names[] = {"Integer", "Real", "Text", "Key"};
+    return names[type];
+}
+}
+
+ColumnStore::ColumnStore(const std::string& prefix,
+                         const FieldCatalog& catalog)
+    : m_prefix(prefix), m_catalog(catalog)
+{
+    const std::string name = m_prefix + ".columns";
+    m_file = fopen(name.c_str(), "wb");
+    if (m_file == nullptr)
+    { throw std::runtime_error("Error: Cannot create column store: " + name); }
+    if (fwrite(magic, 1, sizeof(magic), m_file) != sizeof(magic))
+    { throw std::runtime_error("Error: Failed to write column store: " + name); }
+    m_offset = sizeof(magic);
+}
+
+ColumnStore::~ColumnStore()
+{
+    if (m_file != nullptr) fclose(m_file);
+}
+
+void ColumnStore::add(const EavRecord& record)
+{
+    if (!m_has_current || record.field != m_current.field
+        || record.instance != m_current.instance
+        || record.array != m_current.array)
+    {
+        flush();
+        m_current.field = record.field;
+        m_current.instance = record.instance;
+        m_current.array = record.array;
+        m_encoded = record.encoded;
+        m_has_current = true;
+    }
+    auto&& loc = std::lower_bound(m_participants.begin(), m_participants.end(),
+                                  record.id);
+    if (loc == m_participants.end() || *loc != record.id)
+    {
+        throw std::runtime_error("Error: Participant " + std::to_string(record.id)
+                                 + " missing from the column store");
+    }
+    m_index.push_back(static_cast<size_t>(loc - m_participants.begin()));
+    if (m_encoded)
+    {
+        m_keys.push_back(record.key);
+        return;
+    }
+    m_text.insert(m_text.end(), record.value.begin(), record.value.end());
+    m_text_end.push_back(m_text.size());
+}
+
+void ColumnStore::flush()
+{
+    if (!m_has_current) return;
+    m_has_current = false;
+    const size_t num_row = m_participants.size();
+    const size_t num_cell = m_index.size();
+    // pick the narrowest type all cells fit, continuous fields stay real
+    // even when every value happens to be whole
+    Type type = Type::Key;
+    std::vector<long long> ints;
+    std::vector<double> reals;
+    if (!m_encoded)
+    {
+        const bool continuous =
+            m_catalog.type(m_current.field) == ValueType::Continuous;
+        type = continuous ? Type::Real : Type::Integer;
+        size_t begin = 0;
+        long long int_value;
+        double real_value;
+        for (size_t i = 0; i < num_cell && type != Type::Text; ++i)
+        {
+            const misc::string_view value(m_text.data() + begin,
+                                          m_text_end[i] - begin);
+            begin = m_text_end[i];
+            if (type == Type::Integer && misc::parse_int(value, int_value))
+            {
+                ints.push_back(int_value);
+                continue;
+            }
+            if (type == Type::Integer)
+            {
+                // fall back to real, keeping what we have so far
+                type = Type::Real;
+                for (auto&& v : ints) reals.push_back(static_cast<double>(v));
+            }
+            if (misc::parse_double(value, real_value))
+            { reals.push_back(real_value); }
+            else
+            {
+                type = Type::Text;
+            }
+        }
+    }
+    const size_t bitmap_size = (num_row + 7) / 8;
+    m_payload.assign(bitmap_size, static_cast<char>(0xFF));
+    if (type == Type::Text)
+    {
+        // offsets first, so the cells can be placed in participant order
+        std::vector<size_t> cell_of(num_row, num_cell);
+        for (size_t i = 0; i < num_cell; ++i) cell_of[m_index[i]] = i;
+        const size_t offset_begin = m_payload.size();
+        m_payload.resize(offset_begin + (num_row + 1) * sizeof(uint64_t));
+        uint64_t offset = 0;
+        for (size_t row = 0; row < num_row; ++row)
+        {
+            put(m_payload, offset_begin + row * sizeof(uint64_t), offset);
+            const size_t cell = cell_of[row];
+            if (cell == num_cell) continue;
+            const size_t begin = (cell == 0) ? 0 : m_text_end[cell - 1];
+            m_payload.insert(m_payload.end(), m_text.begin() + begin,
+                             m_text.begin() + m_text_end[cell]);
+            offset += m_text_end[cell] - begin;
+        }
+        put(m_payload, offset_begin + num_row * sizeof(uint64_t), offset);
+    }
+    else
+    {
+        const size_t value_begin = m_payload.size();
+        m_payload.resize(value_begin + num_row * sizeof(int64_t), 0);
+        for (size_t i = 0; i < num_cell; ++i)
+        {
+            const size_t pos = value_begin + m_index[i] * sizeof(int64_t);
+            switch (type)
+            {
+            case Type::Key: put(m_payload, pos, m_keys[i]); break;
+            case Type::Integer:
+                put(m_payload, pos, static_cast<int64_t>(ints[i]));
+                break;
+            case Type::Real: put(m_payload, pos, reals[i]); break;
+            case Type::Text: break;
+            }
+        }
+    }
+    for (auto&& row : m_index)
+    { m_payload[row / 8] &= static_cast<char>(~(1u << (row % 8))); }
+    uint64_t missing = 0;
+    for (size_t row = 0; row < num_row; ++row)
+    { missing += (m_payload[row / 8] >> (row % 8)) & 1; }
+    m_current.missing = missing;
+    write_chunk(type, m_payload);
+    m_index.clear();
+    m_keys.clear();
+    m_text_end.clear();
+    m_text.clear();
+}
+
+void ColumnStore::write_chunk(Type type, const std::vector<char>& payload)
+{
+    uLongf size = compressBound(static_cast<uLong>(payload.size()));
+    m_compressed.resize(size);
+    if (compress2(m_compressed.data(), &size,
+                  reinterpret_cast<const Bytef*>(payload.data()),
+                  static_cast<uLong>(payload.size()), Z_DEFAULT_COMPRESSION)
+        != Z_OK)
+    { throw std::runtime_error("Error: Failed to compress column chunk"); }
+    if (fwrite(m_compressed.data(), 1, size, m_file) != size)
+    {
+        throw std::runtime_error("Error: Failed to write column store: "
+                                 + m_prefix + ".columns");
+    }
+    m_current.type = type;
+    m_current.offset = m_offset;
+    m_current.bytes = size;
+    m_chunks.push_back(m_current);
+    m_offset += size;
+}
+
+void ColumnStore::finish()
+{
+    flush();
+    // the participant IDs, as FieldID 0 like f.eid in the phenotype header
+    const size_t num_row = m_participants.size();
+    m_payload.assign((num_row + 7) / 8, 0);
+    const size_t value_begin = m_payload.size();
+    m_payload.resize(value_begin + num_row * sizeof(int64_t));
+    for (size_t row = 0; row < num_row; ++row)
+    {
+        put(m_payload, value_begin + row * sizeof(int64_t),
+            m_participants[row]);
+    }
+    m_current.field = m_current.instance = m_current.array = 0;
+    m_current.missing = 0;
+    write_chunk(Type::Integer, m_payload);
+    if (fclose(m_file) != 0)
+    {
+        m_file = nullptr;
+        throw std::runtime_error("Error: Failed to write column store: "
+                                 + m_prefix + ".columns");
+    }
+    m_file = nullptr;
+}
+
+void ColumnStore::write_catalog(sqlite3* db)
+{
+    const std::string name = m_prefix + ".catalog";
+    FILE* catalog = fopen(name.c_str(), "w");
+    if (catalog == nullptr)
+    { throw std::runtime_error("Error: Cannot create column catalog: " + name); }
+    sqlite3_stmt* meta = nullptr;
+    // DATA_META may be missing if the showcase failed to load, the catalog is
+    // still usable without the descriptions
+    sqlite3_prepare_v2(db,
+                       "SELECT Field, ValueType, Coding FROM DATA_META "
+                       "WHERE FieldID = ?",
+                       -1, &meta, nullptr);
+    fprintf(catalog, "FieldID\tInstance\tArray\tType\tOffset\tBytes\tRows\t"
+                     "Missing\tField\tValueType\tCoding\n");
+    for (auto&& chunk : m_chunks)
+    {
+        std::string field = chunk.field == 0 ? "eid" : "", value_type, coding;
+        if (meta != nullptr && chunk.field != 0)
+        {
+            sqlite3_bind_int64(meta, 1, chunk.field);
+            if (sqlite3_step(meta) == SQLITE_ROW)
+            {
+                for (int i = 0; i < 3; ++i)
+                {
+                    const unsigned char* text = sqlite3_column_text(meta, i);
+                    std::string& out =
+                        (i == 0) ? field : (i == 1 ? value_type : coding);
+                    out = text ? reinterpret_cast<const char*>(text) : "";
+                }
+            }
+            sqlite3_reset(meta);
+        }
+        fprintf(catalog,
+                "%lld\t%lld\t%lld\t%s\t%llu\t%llu\t%zu\t%llu\t%s\t%s\t%s\n",
+                static_cast<long long>(chunk.field),
+                static_cast<long long>(chunk.instance),
+                static_cast<long long>(chunk.array),
+                type_name(static_cast<int>(chunk.type)),
+                static_cast<unsigned long long>(chunk.offset),
+                static_cast<unsigned long long>(chunk.bytes),
+                m_participants.size(),
+                static_cast<unsigned long long>(chunk.missing), field.c_str(),
+                value_type.c_str(), coding.c_str());
+    }
+    sqlite3_finalize(meta);
+    fclose(catalog);
+    std::cerr << "Wrote " << m_chunks.size() << " column chunk(s) to "
+              << m_prefix << ".columns (" << m_offset / 1048576.0
+              << " MB), catalog in " << name << std::endl;
+}
@@ -0,0 +1,81 @@
+#ifndef PROCESS_COLUMN_STORE_H
+#define PROCESS_COLUMN_STORE_H
+
+#include "external_sort.h"
+#include "field_catalog.h"
+#include <cstdint>
+#include <cstdio>
+#include <sqlite3.h>
+#include <string>
+#include <vector>
+
+// Write the phenotype as one zlib compressed chunk per (FieldID, Instance,
+// Array) into <prefix>.columns, with a tab delimited catalog of the chunks in
+// <prefix>.catalog. Each chunk covers every participant, in ascending ID
+// order, and decompresses to a bitmap with one bit set per missing
+// participant followed by the values:
+//   Integer, Key  8 byte signed integer per participant (Key refers to
+//                 PHENO_META)
+//   Real          8 byte double per participant
+//   Text          (participants + 1) 8 byte offsets into the text that follows
+// Missing participants hold 0 or empty text. The participant IDs themselves
+// are the Integer chunk of FieldID 0
+class ColumnStore
+{
+public:
+    // catalog gives the ValueType of each field in the data showcase
+    ColumnStore(const std::string& prefix, const FieldCatalog& catalog);
+    ~ColumnStore();
+    ColumnStore(const ColumnStore&) = delete;
+    ColumnStore& operator=(const ColumnStore&) = delete;
+    // set the participants, in ascending order, before the first add
+    void start(std::vector<int64_t> participants)
+    {
+        m_participants = std::move(participants);
+    }
+    // add a record, in (field, instance, array, id) order
+    void add(const EavRecord& record);
+    // write the last chunk and the participant IDs
+    void finish();
+    // write the catalog, with field name, value type and coding from DATA_META
+    void write_catalog(sqlite3* db);
+
+private:
+    enum class Type
+    {
+        Integer,
+        Real,
+        Text,
+        Key
+    };
+    struct Chunk
+    {
+        int64_t field;
+        int64_t instance;
+        int64_t array;
+        Type type;
+        uint64_t offset;
+        uint64_t bytes;
+        uint64_t missing;
+    };
+    void flush();
+    void write_chunk(Type type, const std::vector<char>& payload);
+    std::string m_prefix;
+    std::vector<int64_t> m_participants;
+    const FieldCatalog& m_catalog;
+    FILE* m_file = nullptr;
+    uint64_t m_offset = 0;
+    std::vector<Chunk> m_chunks;
+    // cells of the chunk being gathered
+    Chunk m_current;
+    bool m_has_current = false;
+    bool m_encoded = false;
+    std::vector<size_t> m_index;
+    std::vector<int64_t> m_keys;
+    std::vector<size_t> m_text_end;
+    std::vector<char> m_text;
+    std::vector<char> m_payload;
+    std::vector<unsigned char> m_compressed;
+};
+
+#endif // PROCESS_COLUMN_STORE_H
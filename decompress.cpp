@@ -0,0 +1,534 @@
+#include "decompress.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef UKB_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+namespace
+{
+const size_t input_size = 1024 * 1024;
+const size_t output_size = 4 * 1024 * 1024;
+// seekable zstd seek table: a skippable frame whose last 9 bytes are the
+// number of frames, a descriptor and this magic number
+const uint32_t skippable_magic = 0x184D2A5E;
+const uint32_t seekable_magic = 0x8F92EAB1;
+const size_t seek_footer_size = 9;
+
+uint32_t get_u32(const char* ptr)
+{
+    const unsigned char* byte = reinterpret_cast<const unsigned char*>(ptr);
+    return static_cast<uint32_t>(byte[0]) | static_cast<uint32_t>(byte[1]) << 8
+           | static_cast<uint32_t>(byte[2]) << 16
+           | static_cast<uint32_t>(byte[3]) << 24;
+}
+}
+
+const size_t Decompressor::magic_size;
+
+Decompressor::Format Decompressor::detect(const char* magic, size_t size)
+{
+    const unsigned char* byte = reinterpret_cast<const unsigned char*>(magic);
+    if (size >= 2 && byte[0] == 0x1f && byte[1] == 0x8b)
+    {
+        // BGZF keeps the block size in a "BC" extra field, always the first
+        if (size >= magic_size && byte[2] == 8 && (byte[3] & 4) != 0
+            && byte[10] == 6 && byte[11] == 0 && byte[12] == 'B'
+            && byte[13] == 'C' && byte[14] == 2 && byte[15] == 0)
+        { return Format::Bgzf; }
+        return Format::Gzip;
+    }
+    if (size >= 4 && byte[0] == 0x28 && byte[1] == 0xb5 && byte[2] == 0x2f
+        && byte[3] == 0xfd)
+    { return Format::Zstd; }
+    return Format::None;
+}
+
+const char* Decompressor::name(Format format)
+{
+    switch (format)
+    {
+    case Format::Gzip: return "gzip";
+    case Format::Bgzf: return "BGZF";
+    case Format::Zstd: return "zstd";
+    case Format::SeekableZstd: return "seekable zstd";
+    case Format::None: break;
+    }
+    return "uncompressed";
+}
+
+Decompressor::Decompressor(int fd, Format format, std::vector<char> prefix,
+                           size_t num_thread)
+    : m_fd(fd), m_format(format), m_prefix(std::move(prefix))
+{
+#ifndef UKB_WITH_ZSTD
+    if (m_format == Format::Zstd || m_format == Format::SeekableZstd)
+    {
+        throw std::runtime_error(
+            "Error: Input is zstd compressed, but this program was built "
+            "without zstd support");
+    }
+#endif
+    if (m_format == Format::Zstd && load_seek_table())
+    { m_format = Format::SeekableZstd; }
+    if (m_format == Format::Bgzf || m_format == Format::SeekableZstd)
+    {
+        if (num_thread == 0) num_thread = 1;
+        m_jobs.reset(new BoundedQueue<Job>(2 * num_thread));
+        m_output.reset(new OrderedQueue<Chunk>(2 * num_thread + 2, num_thread));
+        for (size_t i = 0; i < num_thread; ++i)
+        { m_workers.emplace_back([this]() { run_worker(); }); }
+        m_thread = std::thread([this]() {
+            try
+            {
+                run_split();
+            }
+            catch (...)
+            {
+                m_failure.set(std::current_exception());
+                m_output->close();
+            }
+            m_jobs->close();
+        });
+        return;
+    }
+    m_output.reset(new OrderedQueue<Chunk>(4, 1));
+    m_thread = std::thread([this]() {
+        try
+        {
+            if (m_format == Format::Gzip) { run_gzip(); }
+            else
+            {
+                run_zstd();
+            }
+        }
+        catch (...)
+        {
+            m_failure.set(std::current_exception());
+            m_output->close();
+        }
+        m_output->done();
+    });
+}
+
+Decompressor::~Decompressor()
+{
+    m_output->close();
+    if (m_jobs) m_jobs->close();
+    if (m_thread.joinable()) m_thread.join();
+    for (auto&& worker : m_workers)
+    {
+        if (worker.joinable()) worker.join();
+    }
+}
+
+size_t Decompressor::read(char* dest, size_t size)
+{
+    while (m_chunk_pos == m_chunk.data.size())
+    {
+        if (!m_output->pop(m_chunk))
+        {
+            m_failure.rethrow();
+            return 0;
+        }
+        m_chunk_pos = 0;
+    }
+    const size_t num_copy = std::min(size, m_chunk.data.size() - m_chunk_pos);
+    memcpy(dest, m_chunk.data.data() + m_chunk_pos, num_copy);
+    m_chunk_pos += num_copy;
+    return num_copy;
+}
+
+bool Decompressor::load_seek_table()
+{
+    struct stat info;
+    if (!m_prefix.empty() || fstat(m_fd, &info) != 0 || !S_ISREG(info.st_mode)
+        || info.st_size < static_cast<off_t>(seek_footer_size + 8))
+    { return false; }
+    const unsigned long long file_size =
+        static_cast<unsigned long long>(info.st_size);
+    char footer[seek_footer_size];
+    if (pread(m_fd, footer, seek_footer_size,
+              static_cast<off_t>(file_size - seek_footer_size))
+            != static_cast<ssize_t>(seek_footer_size)
+        || get_u32(footer + 5) != seekable_magic)
+    { return false; }
+    const unsigned long long num_frame = get_u32(footer);
+    // the descriptor says whether each entry carries a checksum
+    const size_t entry_size = (footer[4] & 0x80) ? 12 : 8;
+    const unsigned long long table_size =
+        8 + num_frame * entry_size + seek_footer_size;
+    if (table_size > file_size) return false;
+    std::vector<char> table(static_cast<size_t>(table_size));
+    if (pread(m_fd, table.data(), table.size(),
+              static_cast<off_t>(file_size - table_size))
+            != static_cast<ssize_t>(table.size())
+        || get_u32(table.data()) != skippable_magic
+        || get_u32(table.data() + 4) != table_size - 8)
+    { return false; }
+    unsigned long long compressed = 0;
+    m_frames.clear();
+    for (unsigned long long i = 0; i < num_frame; ++i)
+    {
+        const char* entry = table.data() + 8 + i * entry_size;
+        m_frames.emplace_back(get_u32(entry), get_u32(entry + 4));
+        compressed += m_frames.back().first;
+    }
+    // the frames must account for everything before the table, or this is
+    // not a file we can split
+    if (compressed + table_size != file_size)
+    {
+        m_frames.clear();
+        return false;
+    }
+    return true;
+}
+
+size_t Decompressor::read_input(std::vector<char>& input)
+{
+    if (m_prefix_pos < m_prefix.size())
+    {
+        input.assign(m_prefix.begin() + static_cast<long>(m_prefix_pos),
+                     m_prefix.end());
+        m_prefix_pos = m_prefix.size();
+        m_consumed += input.size();
+        return input.size();
+    }
+    input.resize(input_size);
+    ssize_t num_read;
+    do
+    {
+        num_read = ::read(m_fd, input.data(), input.size());
+    } while (num_read == -1 && errno == EINTR);
+    if (num_read < 0)
+    { throw std::runtime_error("Error: Failed to read compressed input"); }
+    m_consumed += static_cast<unsigned long long>(num_read);
+    return static_cast<size_t>(num_read);
+}
+
+size_t Decompressor::read_exact(char* dest, size_t size)
+{
+    size_t have = std::min(size, m_prefix.size() - m_prefix_pos);
+    memcpy(dest, m_prefix.data() + m_prefix_pos, have);
+    m_prefix_pos += have;
+    while (have < size)
+    {
+        const ssize_t num_read = ::read(m_fd, dest + have, size - have);
+        if (num_read == -1 && errno == EINTR) continue;
+        if (num_read < 0)
+        { throw std::runtime_error("Error: Failed to read compressed input"); }
+        if (num_read == 0) break;
+        have += static_cast<size_t>(num_read);
+    }
+    m_consumed += have;
+    return have;
+}
+
+bool Decompressor::emit(Chunk& chunk)
+{
+    chunk.consumed = m_consumed;
+    const bool pushed = m_output->push(m_seq++, std::move(chunk));
+    chunk = Chunk();
+    chunk.data.resize(output_size);
+    return pushed;
+}
+
+void Decompressor::run_gzip()
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // 32 lets zlib take either a gzip or a zlib header
+    if (inflateInit2(&stream, 15 + 32) != Z_OK)
+    { throw std::runtime_error("Error: Failed to initialize zlib"); }
+    std::vector<char> input;
+    Chunk chunk;
+    chunk.data.resize(output_size);
+    size_t have = 0;
+    bool in_member = false;
+    // zlib may hold back output when the buffer fills up, only read more once
+    // it had room to spare
+    bool drained = true;
+    try
+    {
+        while (true)
+        {
+            if (stream.avail_in == 0 && drained)
+            {
+                const size_t num_read = read_input(input);
+                if (num_read == 0) break;
+                stream.next_in = reinterpret_cast<Bytef*>(input.data());
+                stream.avail_in = static_cast<uInt>(num_read);
+            }
+            stream.next_out = reinterpret_cast<Bytef*>(chunk.data.data() + have);
+            stream.avail_out = static_cast<uInt>(chunk.data.size() - have);
+            const int status = inflate(&stream, Z_NO_FLUSH);
+            have = chunk.data.size() - stream.avail_out;
+            drained = stream.avail_out != 0;
+            if (status == Z_STREAM_END)
+            {
+                // a new member may follow, e.g. in BGZF or concatenated files
+                inflateReset(&stream);
+                in_member = false;
+            }
+            else if (status == Z_OK)
+            {
+                in_member = true;
+            }
+            else if (status != Z_BUF_ERROR)
+            {
+                throw std::runtime_error(
+                    std::string("Error: Corrupted gzip input: ")
+                    + (stream.msg ? stream.msg : "unknown error"));
+            }
+            if (have == chunk.data.size())
+            {
+                // the reader stopped early, nobody wants the rest
+                if (!emit(chunk))
+                {
+                    inflateEnd(&stream);
+                    return;
+                }
+                have = 0;
+            }
+        }
+        if (in_member)
+        { throw std::runtime_error("Error: Truncated gzip input"); }
+        chunk.data.resize(have);
+        if (have != 0) emit(chunk);
+    }
+    catch (...)
+    {
+        inflateEnd(&stream);
+        throw;
+    }
+    inflateEnd(&stream);
+}
+
+void Decompressor::run_zstd()
+{
+#ifdef UKB_WITH_ZSTD
+    ZSTD_DStream* stream = ZSTD_createDStream();
+    if (stream == nullptr || ZSTD_isError(ZSTD_initDStream(stream)))
+    {
+        ZSTD_freeDStream(stream);
+        throw std::runtime_error("Error: Failed to initialize zstd");
+    }
+    std::vector<char> input;
+    Chunk chunk;
+    chunk.data.resize(output_size);
+    ZSTD_inBuffer in = {nullptr, 0, 0};
+    ZSTD_outBuffer out = {chunk.data.data(), chunk.data.size(), 0};
+    // 0 once a frame is complete
+    size_t status = 0;
+    bool drained = true;
+    try
+    {
+        while (true)
+        {
+            if (in.pos == in.size && drained)
+            {
+                const size_t num_read = read_input(input);
+                if (num_read == 0) break;
+                in.src = input.data();
+                in.size = num_read;
+                in.pos = 0;
+            }
+            status = ZSTD_decompressStream(stream, &out, &in);
+            if (ZSTD_isError(status))
+            {
+                throw std::runtime_error(
+                    std::string("Error: Corrupted zstd input: ")
+                    + ZSTD_getErrorName(status));
+            }
+            drained = out.pos != out.size;
+            if (out.pos == out.size)
+            {
+                if (!emit(chunk))
+                {
+                    ZSTD_freeDStream(stream);
+                    return;
+                }
+                out.dst = chunk.data.data();
+                out.size = chunk.data.size();
+                out.pos = 0;
+            }
+        }
+        if (status != 0)
+        { throw std::runtime_error("Error: Truncated zstd input"); }
+        chunk.data.resize(out.pos);
+        if (out.pos != 0) emit(chunk);
+    }
+    catch (...)
+    {
+        ZSTD_freeDStream(stream);
+        throw;
+    }
+    ZSTD_freeDStream(stream);
+#endif
+}
+
+void Decompressor::run_split()
+{
+    Job job;
+    size_t num_frame = 0;
+    while (true)
+    {
+        size_t block_size = 0, decompressed = 0;
+        const size_t begin = job.data.size();
+        if (m_format == Format::Bgzf)
+        {
+            // the header holds the size of the whole block, and the last 4
+            // bytes of the block its decompressed size
+            job.data.resize(begin + magic_size);
+            const size_t num_read = read_exact(&job.data[begin], magic_size);
+            if (num_read == 0)
+            {
+                job.data.resize(begin);
+                break;
+            }
+            if (num_read != magic_size)
+            { throw std::runtime_error("Error: Truncated BGZF input"); }
+            if (detect(&job.data[begin], magic_size) != Format::Bgzf)
+            {
+                throw std::runtime_error(
+                    "Error: Corrupted BGZF input, block without its size");
+            }
+            const unsigned char* byte =
+                reinterpret_cast<const unsigned char*>(&job.data[begin]);
+            block_size = (static_cast<size_t>(byte[16])
+                          | static_cast<size_t>(byte[17]) << 8)
+                         + 1;
+            if (block_size < magic_size + 8)
+            { throw std::runtime_error("Error: Corrupted BGZF input"); }
+            job.data.resize(begin + block_size);
+            if (read_exact(&job.data[begin + magic_size],
+                           block_size - magic_size)
+                != block_size - magic_size)
+            { throw std::runtime_error("Error: Truncated BGZF input"); }
+            decompressed = get_u32(&job.data[begin + block_size - 4]);
+        }
+        else
+        {
+            if (num_frame == m_frames.size()) break;
+            block_size = m_frames[num_frame].first;
+            decompressed = m_frames[num_frame].second;
+            ++num_frame;
+            job.data.resize(begin + block_size);
+            if (read_exact(&job.data[begin], block_size) != block_size)
+            { throw std::runtime_error("Error: Truncated zstd input"); }
+        }
+        job.block_end.push_back(job.data.size());
+        job.block_size.push_back(decompressed);
+        job.total_size += decompressed;
+        if (job.data.size() < input_size && job.total_size < output_size)
+            continue;
+        job.seq = m_seq++;
+        job.consumed = m_consumed;
+        // the reader stopped early, nobody wants the rest
+        if (!m_jobs->push(std::move(job))) return;
+        job = Job();
+    }
+    if (job.block_end.empty()) return;
+    job.seq = m_seq++;
+    job.consumed = m_consumed;
+    m_jobs->push(std::move(job));
+}
+
+void Decompressor::run_worker()
+{
+    Job job;
+    try
+    {
+        while (m_jobs->pop(job))
+        {
+            Chunk chunk;
+            chunk.data.resize(job.total_size);
+            chunk.consumed = job.consumed;
+            if (m_format == Format::Bgzf) { decompress_bgzf(job, chunk); }
+            else
+            {
+                decompress_zstd(job, chunk);
+            }
+            if (!m_output->push(job.seq, std::move(chunk))) break;
+        }
+    }
+    catch (...)
+    {
+        m_failure.set(std::current_exception());
+        m_jobs->close();
+        m_output->close();
+    }
+    m_output->done();
+}
+
+void Decompressor::decompress_bgzf(const Job& job, Chunk& chunk)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // each block is a complete gzip member, zlib checks its CRC for us
+    if (inflateInit2(&stream, 15 + 16) != Z_OK)
+    { throw std::runtime_error("Error: Failed to initialize zlib"); }
+    size_t begin = 0, out = 0;
+    // zlib refuses a null output buffer even with nothing to write, as for
+    // the empty end of file block alone in a job
+    Bytef none;
+    for (size_t i = 0; i < job.block_end.size(); ++i)
+    {
+        inflateReset(&stream);
+        stream.next_in = reinterpret_cast<Bytef*>(
+            const_cast<char*>(job.data.data() + begin));
+        stream.avail_in = static_cast<uInt>(job.block_end[i] - begin);
+        stream.next_out =
+            job.block_size[i] != 0
+                ? reinterpret_cast<Bytef*>(chunk.data.data() + out)
+                : &none;
+        stream.avail_out = static_cast<uInt>(job.block_size[i]);
+        const int status = inflate(&stream, Z_FINISH);
+        if (status != Z_STREAM_END || stream.avail_out != 0)
+        {
+            const std::string message =
+                stream.msg ? stream.msg : "block size mismatch";
+            inflateEnd(&stream);
+            throw std::runtime_error("Error: Corrupted BGZF input: "
+                                     + message);
+        }
+        begin = job.block_end[i];
+        out += job.block_size[i];
+    }
+    inflateEnd(&stream);
+}
+
+void Decompressor::decompress_zstd(const Job& job, Chunk& chunk)
+{
+#ifdef UKB_WITH_ZSTD
+    ZSTD_DCtx* context = ZSTD_createDCtx();
+    if (context == nullptr)
+    { throw std::runtime_error("Error: Failed to initialize zstd"); }
+    size_t begin = 0, out = 0;
+    for (size_t i = 0; i < job.block_end.size(); ++i)
+    {
+        const size_t size = ZSTD_decompressDCtx(
+            context, chunk.data.data() + out, job.block_size[i],
+            job.data.data() + begin, job.block_end[i] - begin);
+        if (ZSTD_isError(size) || size != job.block_size[i])
+        {
+            const std::string message = ZSTD_isError(size)
+                                            ? ZSTD_getErrorName(size)
+                                            : "frame size mismatch";
+            ZSTD_freeDCtx(context);
+            throw std::runtime_error("Error: Corrupted zstd input: " + message);
+        }
+        begin = job.block_end[i];
+        out += job.block_size[i];
+    }
+    ZSTD_freeDCtx(context);
+#else
+    (void) job;
+    (void) chunk;
+#endif
+}
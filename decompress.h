@@ -0,0 +1,95 @@
+#ifndef PROCESS_DECOMPRESS_H
+#define PROCESS_DECOMPRESS_H
+
+#include "pipeline.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Decompress a gzip or zstd stream on a background thread, so inflating the
+// next block overlaps with parsing the current one. Concatenated members or
+// frames are read as one stream.
+// BGZF input (gzip members each carrying their compressed size, as written by
+// bgzip or recompress) and seekable zstd (frames listed in a seek table at the
+// end of the file) are split into blocks up front, and the blocks decompressed
+// by a pool of threads
+class Decompressor
+{
+public:
+    enum class Format
+    {
+        None,
+        Gzip,
+        Bgzf,
+        Zstd,
+        SeekableZstd
+    };
+    // bytes needed by detect to recognize every format it knows of
+    static const size_t magic_size = 18;
+    // Work out the format from the first bytes of the input. A seekable zstd
+    // file starts as any other zstd file, it is only told apart once its end
+    // is read by the constructor
+    static Format detect(const char* magic, size_t size);
+    static const char* name(Format format);
+    // prefix holds bytes already read from fd, they are decompressed first.
+    // num_thread is only used for BGZF and seekable zstd
+    Decompressor(int fd, Format format, std::vector<char> prefix,
+                 size_t num_thread = 1);
+    ~Decompressor();
+    Decompressor(const Decompressor&) = delete;
+    Decompressor& operator=(const Decompressor&) = delete;
+    // Copy up to size decompressed bytes to dest, return the number copied,
+    // 0 at end of stream
+    size_t read(char* dest, size_t size);
+    // number of compressed bytes behind the data returned so far
+    unsigned long long compressed_consumed() const { return m_chunk.consumed; }
+    Format format() const { return m_format; }
+
+private:
+    struct Chunk
+    {
+        std::vector<char> data;
+        unsigned long long consumed = 0;
+    };
+    // independent blocks handed to one worker
+    struct Job
+    {
+        size_t seq = 0;
+        std::vector<char> data;
+        // end of each block in data, and its size once decompressed
+        std::vector<size_t> block_end;
+        std::vector<size_t> block_size;
+        size_t total_size = 0;
+        unsigned long long consumed = 0;
+    };
+    void run_gzip();
+    void run_zstd();
+    void run_split();
+    void run_worker();
+    bool load_seek_table();
+    size_t read_input(std::vector<char>& input);
+    size_t read_exact(char* dest, size_t size);
+    bool emit(Chunk& chunk);
+    void decompress_bgzf(const Job& job, Chunk& chunk);
+    void decompress_zstd(const Job& job, Chunk& chunk);
+    int m_fd;
+    Format m_format;
+    std::vector<char> m_prefix;
+    size_t m_prefix_pos = 0;
+    unsigned long long m_consumed = 0;
+    size_t m_seq = 0;
+    // compressed and decompressed size of each seekable zstd frame
+    std::vector<std::pair<uint32_t, uint32_t>> m_frames;
+    std::unique_ptr<BoundedQueue<Job>> m_jobs;
+    std::unique_ptr<OrderedQueue<Chunk>> m_output;
+    StageError m_failure;
+    Chunk m_chunk;
+    size_t m_chunk_pos = 0;
+    std::thread m_thread;
+    std::vector<std::thread> m_workers;
+};
+
+#endif // PROCESS_DECOMPRESS_H
@@ -0,0 +1,288 @@
+#include "external_sort.h"
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace
+{
+// fixed part of a serialized record: field, instance, array, id and a flag
+// telling whether a key or the value text follows
+const size_t header_size = 4 * sizeof(int64_t) + 1;
+
+template <typename T>
+void put(std::vector<char>& out, const T& value)
+{
+    const char* ptr = reinterpret_cast<const char*>(&value);
+    out.insert(out.end(), ptr, ptr + sizeof(T));
+}
+
+template <typename T>
+T get(const char* ptr)
+{
+    T value;
+    memcpy(&value, ptr, sizeof(T));
+    return value;
+}
+}
+
+ExternalSorter::ExternalSorter(const std::string& temp_dir,
+                               size_t num_thread, size_t run_byte)
+    : m_temp_dir(temp_dir.empty() ? "." : temp_dir)
+    , m_run_byte(run_byte)
+    , m_queue(num_thread == 0 ? 1 : num_thread)
+{
+    if (num_thread == 0) num_thread = 1;
+    for (size_t i = 0; i < num_thread; ++i)
+    {
+        m_workers.emplace_back([this]() {
+            Run run;
+            std::vector<char> serialized;
+            try
+            {
+                while (m_queue.pop(run))
+                {
+                    sort_run(run, serialized);
+                    run = Run();
+                    FILE* file = spill(serialized);
+                    std::lock_guard<std::mutex> lock(m_spill_mutex);
+                    m_spills.push_back(file);
+                }
+            }
+            catch (...)
+            {
+                m_failure.set(std::current_exception());
+                m_queue.close();
+            }
+        });
+    }
+}
+
+ExternalSorter::~ExternalSorter()
+{
+    m_queue.close();
+    for (auto&& worker : m_workers)
+    {
+        if (worker.joinable()) worker.join();
+    }
+    // spill files are already unlinked, closing them frees the space
+    for (auto&& file : m_spills) fclose(file);
+}
+
+void ExternalSorter::add(const EavRecord& record)
+{
+    if (m_finished)
+    { throw std::runtime_error("Error: Record added to a finished sort"); }
+    Entry entry;
+    entry.field = record.field;
+    entry.instance = record.instance;
+    entry.array = record.array;
+    entry.id = record.id;
+    entry.key = record.key;
+    entry.encoded = record.encoded;
+    entry.offset = m_run.text.size();
+    entry.size = static_cast<uint32_t>(record.encoded ? 0 : record.value.size());
+    if (!record.encoded)
+    {
+        m_run.text.insert(m_run.text.end(), record.value.begin(),
+                          record.value.end());
+    }
+    m_run.entries.push_back(entry);
+    ++m_num_record;
+    if (m_run.bytes() < m_run_byte) return;
+    spill_run();
+}
+
+void ExternalSorter::spill_run()
+{
+    if (m_finished || m_run.entries.empty()) return;
+    // hand the run to a worker, this blocks while all of them are busy
+    if (!m_queue.push(std::move(m_run))) m_failure.rethrow();
+    m_run = Run();
+    m_failure.rethrow();
+}
+
+void ExternalSorter::sort_run(Run& run, std::vector<char>& serialized)
+{
+    std::sort(run.entries.begin(), run.entries.end(),
+              [](const Entry& a, const Entry& b) {
+                  if (a.field != b.field) return a.field < b.field;
+                  if (a.instance != b.instance) return a.instance < b.instance;
+                  if (a.array != b.array) return a.array < b.array;
+                  return a.id < b.id;
+              });
+    serialized.clear();
+    serialized.reserve(run.entries.size() * (header_size + sizeof(int64_t))
+                       + run.text.size());
+    for (auto&& entry : run.entries)
+    {
+        put(serialized, entry.field);
+        put(serialized, entry.instance);
+        put(serialized, entry.array);
+        put(serialized, entry.id);
+        serialized.push_back(entry.encoded ? 1 : 0);
+        if (entry.encoded)
+        {
+            put(serialized, entry.key);
+            continue;
+        }
+        put(serialized, entry.size);
+        serialized.insert(serialized.end(), run.text.begin() + entry.offset,
+                          run.text.begin() + entry.offset + entry.size);
+    }
+}
+
+FILE* ExternalSorter::spill(const std::vector<char>& serialized) const
+{
+    std::string name = m_temp_dir + "/ukb_sort_XXXXXX";
+    const int fd = mkstemp(&name[0]);
+    if (fd == -1)
+    {
+        throw std::runtime_error("Error: Cannot create temporary file in "
+                                 + m_temp_dir);
+    }
+    // nobody else needs the name, the space is released once closed
+    unlink(name.c_str());
+    FILE* file = fdopen(fd, "w+b");
+    if (file == nullptr)
+    {
+        close(fd);
+        throw std::runtime_error("Error: Cannot open temporary file in "
+                                 + m_temp_dir);
+    }
+    if (fwrite(serialized.data(), 1, serialized.size(), file)
+            != serialized.size()
+        || fflush(file) != 0)
+    {
+        fclose(file);
+        throw std::runtime_error("Error: Failed to write temporary file in "
+                                 + m_temp_dir
+                                 + ". Please check there is enough space");
+    }
+    rewind(file);
+    return file;
+}
+
+void ExternalSorter::finish()
+{
+    if (m_finished) return;
+    m_finished = true;
+    m_queue.close();
+    for (auto&& worker : m_workers) worker.join();
+    m_failure.rethrow();
+    // the memory that held the runs is shared by the readers merging them
+    size_t read_byte = 1024 * 1024;
+    if (!m_spills.empty())
+    {
+        read_byte = m_run_byte * (3 * m_workers.size() + 1) / m_spills.size();
+        read_byte = std::min<size_t>(std::max<size_t>(read_byte, 64 * 1024),
+                                     1024 * 1024);
+    }
+    for (auto&& file : m_spills)
+    { m_readers.emplace_back(new RunReader(file, read_byte)); }
+    // the last run never has to go to disk
+    if (!m_run.entries.empty())
+    {
+        std::vector<char> serialized;
+        sort_run(m_run, serialized);
+        m_run = Run();
+        m_readers.emplace_back(new RunReader(std::move(serialized)));
+    }
+    for (size_t i = 0; i < m_readers.size(); ++i)
+    {
+        if (m_readers[i]->next(m_readers[i]->current)) m_heap.push_back(i);
+    }
+    std::make_heap(m_heap.begin(), m_heap.end(), greater());
+}
+
+bool ExternalSorter::next(EavRecord& record)
+{
+    if (!m_finished) finish();
+    if (m_has_last)
+    {
+        // the record handed out last time is done with, move its reader on
+        RunReader& reader = *m_readers[m_last];
+        if (reader.next(reader.current))
+        {
+            m_heap.push_back(m_last);
+            std::push_heap(m_heap.begin(), m_heap.end(), greater());
+        }
+        m_has_last = false;
+    }
+    if (m_heap.empty()) return false;
+    std::pop_heap(m_heap.begin(), m_heap.end(), greater());
+    m_last = m_heap.back();
+    m_heap.pop_back();
+    m_has_last = true;
+    record = m_readers[m_last]->current;
+    return true;
+}
+
+bool ExternalSorter::ReaderGreater::operator()(size_t a, size_t b) const
+{
+    const EavRecord& x = sorter->m_readers[a]->current;
+    const EavRecord& y = sorter->m_readers[b]->current;
+    if (x.field != y.field) return x.field > y.field;
+    if (x.instance != y.instance) return x.instance > y.instance;
+    if (x.array != y.array) return x.array > y.array;
+    if (x.id != y.id) return x.id > y.id;
+    // break ties so the order is strict
+    return a > b;
+}
+
+bool ExternalSorter::RunReader::fill(size_t need)
+{
+    if (m_end - m_begin >= need) return true;
+    if (m_file == nullptr) return false;
+    // move the partial record to the front and read the rest after it
+    std::copy(m_buffer.begin() + static_cast<long>(m_begin),
+              m_buffer.begin() + static_cast<long>(m_end), m_buffer.begin());
+    m_end -= m_begin;
+    m_begin = 0;
+    if (m_buffer.size() < std::max(need, m_read_byte))
+    { m_buffer.resize(std::max(need, m_read_byte)); }
+    while (m_end < need)
+    {
+        const size_t num_read =
+            fread(m_buffer.data() + m_end, 1, m_buffer.size() - m_end, m_file);
+        if (num_read == 0) break;
+        m_end += num_read;
+    }
+    return m_end >= need;
+}
+
+bool ExternalSorter::RunReader::next(EavRecord& record)
+{
+    if (!fill(header_size))
+    {
+        if (m_end != m_begin)
+        { throw std::runtime_error("Error: Truncated temporary sort file"); }
+        return false;
+    }
+    const char* ptr = m_buffer.data() + m_begin;
+    record.field = get<int64_t>(ptr);
+    record.instance = get<int64_t>(ptr + 8);
+    record.array = get<int64_t>(ptr + 16);
+    record.id = get<int64_t>(ptr + 24);
+    record.encoded = ptr[32] != 0;
+    m_begin += header_size;
+    if (record.encoded)
+    {
+        if (!fill(sizeof(int64_t)))
+        { throw std::runtime_error("Error: Truncated temporary sort file"); }
+        record.key = get<int64_t>(m_buffer.data() + m_begin);
+        record.value = misc::string_view();
+        m_begin += sizeof(int64_t);
+        return true;
+    }
+    if (!fill(sizeof(uint32_t)))
+    { throw std::runtime_error("Error: Truncated temporary sort file"); }
+    const uint32_t size = get<uint32_t>(m_buffer.data() + m_begin);
+    m_begin += sizeof(uint32_t);
+    if (!fill(size))
+    { throw std::runtime_error("Error: Truncated temporary sort file"); }
+    record.key = 0;
+    record.value = misc::string_view(m_buffer.data() + m_begin, size);
+    m_begin += size;
+    return true;
+}
@@ -0,0 +1,124 @@
+#ifndef PROCESS_EXTERNAL_SORT_H
+#define PROCESS_EXTERNAL_SORT_H
+
+#include "misc.hpp"
+#include "pipeline.h"
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// One phenotype cell, ordered by (field, instance, array, id) which is the
+// primary key of the clustered PHENOTYPE layout. The value is either the text
+// of the cell or, for dictionary encoded fields, the key into PHENO_META
+struct EavRecord
+{
+    int64_t field = 0;
+    int64_t instance = 0;
+    int64_t array = 0;
+    int64_t id = 0;
+    int64_t key = 0;
+    bool encoded = false;
+    misc::string_view value;
+};
+
+// Sort more records than fit in memory. Records are gathered into runs of
+// about run_byte bytes, each full run is sorted by one of num_thread worker
+// threads and spilled to an unlinked temporary file under temp_dir. Once all
+// records are in, next() merges the runs and hands the records back in order
+class ExternalSorter
+{
+public:
+    ExternalSorter(const std::string& temp_dir, size_t num_thread,
+                   size_t run_byte = 64 * 1024 * 1024);
+    ~ExternalSorter();
+    ExternalSorter(const ExternalSorter&) = delete;
+    ExternalSorter& operator=(const ExternalSorter&) = delete;
+    void add(const EavRecord& record);
+    // hand the run gathered so far to a worker now, to free its memory
+    // sooner when memory runs short
+    void spill_run();
+    // stop taking records and start the merge
+    void finish();
+    // Get the next record in order, return false when there is none left. The
+    // value view is valid until the next call
+    bool next(EavRecord& record);
+    unsigned long long num_record() const { return m_num_record; }
+    size_t num_spill() const { return m_spills.size(); }
+
+private:
+    struct Entry
+    {
+        int64_t field;
+        int64_t instance;
+        int64_t array;
+        int64_t id;
+        int64_t key;
+        size_t offset;
+        uint32_t size;
+        bool encoded;
+    };
+    struct Run
+    {
+        std::vector<Entry> entries;
+        std::vector<char> text;
+        size_t bytes() const
+        {
+            return entries.size() * sizeof(Entry) + text.size();
+        }
+    };
+    // reads back a sorted run, from its spill file or from memory
+    class RunReader
+    {
+    public:
+        RunReader(FILE* file, size_t read_byte)
+            : m_file(file), m_read_byte(read_byte)
+        {
+        }
+        RunReader(std::vector<char>&& data)
+            : m_buffer(std::move(data)), m_end(m_buffer.size())
+        {
+        }
+        bool next(EavRecord& record);
+        EavRecord current;
+
+    private:
+        bool fill(size_t need);
+        FILE* m_file = nullptr;
+        // bytes read from the file at a time
+        size_t m_read_byte = 0;
+        std::vector<char> m_buffer;
+        size_t m_begin = 0;
+        size_t m_end = 0;
+    };
+    // orders readers so the one with the smallest record is on top of a heap
+    struct ReaderGreater
+    {
+        const ExternalSorter* sorter;
+        bool operator()(size_t a, size_t b) const;
+    };
+    ReaderGreater greater() const { return ReaderGreater {this}; }
+    static void sort_run(Run& run, std::vector<char>& serialized);
+    FILE* spill(const std::vector<char>& serialized) const;
+    std::string m_temp_dir;
+    size_t m_run_byte;
+    Run m_run;
+    BoundedQueue<Run> m_queue;
+    std::vector<std::thread> m_workers;
+    StageError m_failure;
+    std::mutex m_spill_mutex;
+    std::vector<FILE*> m_spills;
+    std::vector<std::unique_ptr<RunReader>> m_readers;
+    // heap of readers ordered by their current record, smallest on top
+    std::vector<size_t> m_heap;
+    // the reader of the last record handed out, advanced on the next call
+    size_t m_last = 0;
+    bool m_has_last = false;
+    unsigned long long m_num_record = 0;
+    bool m_finished = false;
+};
+
+#endif // PROCESS_EXTERNAL_SORT_H
@@ -0,0 +1,37 @@
+#include "field_catalog.h"
+
+namespace
+{
+const char* type_names[] = {"Unknown",    "Integer",
+                            "Continuous", "Categorical single",
+                            "Categorical multiple",
+                            "Text",       "Date",
+                            "Time",       "Compound"};
+const size_t num_type = sizeof(type_names) / sizeof(type_names[0]);
+}
+
+ValueType FieldCatalog::parse(const misc::string_view& name)
+{
+    for (size_t i = 1; i < num_type; ++i)
+    {
+        if (name == type_names[i]) return static_cast<ValueType>(i);
+    }
+    return ValueType::Unknown;
+}
+
+const char* FieldCatalog::name(ValueType type)
+{
+    return type_names[static_cast<size_t>(type)];
+}
+
+void FieldCatalog::set(int64_t field, ValueType type)
+{
+    if (field < 0 || field > max_dense)
+    {
+        m_sparse[field] = type;
+        return;
+    }
+    const size_t idx = static_cast<size_t>(field);
+    if (idx >= m_types.size()) m_types.resize(idx + 1, ValueType::Unknown);
+    m_types[idx] = type;
+}
@@ -0,0 +1,54 @@
+#ifndef PROCESS_FIELD_CATALOG_H
+#define PROCESS_FIELD_CATALOG_H
+
+#include "misc.hpp"
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// ValueType column of the data showcase
+enum class ValueType : uint8_t
+{
+    Unknown,
+    Integer,
+    Continuous,
+    CategoricalSingle,
+    CategoricalMultiple,
+    Text,
+    Date,
+    Time,
+    Compound
+};
+
+// The ValueType of every field in the data showcase, looked up by integer
+// field ID. Field IDs are small, so types are kept in a vector indexed by
+// them. Filled as DATA_META is written
+class FieldCatalog
+{
+public:
+    void set(int64_t field, ValueType type);
+    ValueType type(int64_t field) const
+    {
+        if (field >= 0 && static_cast<uint64_t>(field) < m_types.size())
+        { return m_types[static_cast<size_t>(field)]; }
+        auto&& found = m_sparse.find(field);
+        return found == m_sparse.end() ? ValueType::Unknown : found->second;
+    }
+    // values of these types repeat a lot, and are worth storing as keys into
+    // PHENO_META when encoding
+    static bool keyed(ValueType type)
+    {
+        return type != ValueType::Unknown && type != ValueType::Integer
+               && type != ValueType::Continuous;
+    }
+    static ValueType parse(const misc::string_view& name);
+    static const char* name(ValueType type);
+
+private:
+    // largest field ID kept in the vector
+    static const int64_t max_dense = 1 << 24;
+    std::vector<ValueType> m_types;
+    std::unordered_map<int64_t, ValueType> m_sparse;
+};
+
+#endif // PROCESS_FIELD_CATALOG_H
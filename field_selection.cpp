@@ -0,0 +1,101 @@
+#include "field_selection.h"
+#include "line_source.h"
+#include <iostream>
+#include <stdexcept>
+
+namespace
+{
+// Parse the comma separated integers of list into ids
+bool parse_ids(const std::string& list, std::vector<int64_t>& ids)
+{
+    std::vector<std::string> token = misc::split(list, ",");
+    if (token.empty()) return false;
+    for (auto&& item : token)
+    {
+        long long id;
+        if (!misc::parse_int(misc::string_view(item), id)) return false;
+        ids.push_back(id);
+    }
+    return true;
+}
+}
+
+bool FieldSelection::add_fields(const std::string& list)
+{
+    std::vector<int64_t> fields;
+    if (!parse_ids(list, fields)) return false;
+    for (auto&& field : fields) m_fields.insert(field);
+    m_active = true;
+    return true;
+}
+
+bool FieldSelection::add_categories(const std::string& list)
+{
+    if (!parse_ids(list, m_categories)) return false;
+    m_active = true;
+    return true;
+}
+
+void FieldSelection::add_field_file(const std::string& file)
+{
+    LineSource source;
+    if (!source.open(file))
+    {
+        throw std::runtime_error(
+            "Error: Cannot open field file: " + file
+            + ". Please check you have the correct input");
+    }
+    misc::string_view line;
+    std::vector<misc::string_view> token;
+    while (source.next(line))
+    {
+        misc::trim(line);
+        if (line.empty() || line.front() == '#') continue;
+        misc::split(token, line, "\t ,");
+        for (auto&& item : token)
+        {
+            long long field;
+            if (!misc::parse_int(item, field))
+            {
+                throw std::runtime_error("Error: Field ID must be an integer: "
+                                         + item.to_string() + " in " + file);
+            }
+            m_fields.insert(field);
+        }
+    }
+    source.close();
+    m_active = true;
+}
+
+void FieldSelection::resolve(sqlite3* db)
+{
+    if (m_categories.empty()) return;
+    sqlite3_stmt* statement = nullptr;
+    if (sqlite3_prepare_v2(db,
+                           "SELECT FieldID FROM DATA_META WHERE Category = ?",
+                           -1, &statement, nullptr)
+        != SQLITE_OK)
+    {
+        const std::string error = sqlite3_errmsg(db);
+        sqlite3_finalize(statement);
+        throw std::runtime_error("Error: Cannot read DATA_META: " + error);
+    }
+    for (auto&& category : m_categories)
+    {
+        sqlite3_bind_int64(statement, 1,
+                           static_cast<sqlite3_int64>(category));
+        size_t num_field = 0;
+        while (sqlite3_step(statement) == SQLITE_ROW)
+        {
+            m_fields.insert(sqlite3_column_int64(statement, 0));
+            ++num_field;
+        }
+        sqlite3_reset(statement);
+        if (num_field == 0)
+        {
+            std::cerr << "Warning: No field of category " << category
+                      << " in the data showcase" << std::endl;
+        }
+    }
+    sqlite3_finalize(statement);
+}
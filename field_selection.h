@@ -0,0 +1,38 @@
+#ifndef PROCESS_FIELD_SELECTION_H
+#define PROCESS_FIELD_SELECTION_H
+
+#include "id_registry.h"
+#include <cstdint>
+#include <sqlite3.h>
+#include <string>
+#include <vector>
+
+// The fields to take from the phenotype files, picked by field ID, by the
+// Category of the data showcase or from a file listing field IDs. Without any
+// of them every field is taken. The other columns are skipped by the parser,
+// and a row is not split past the last column that is wanted
+class FieldSelection
+{
+public:
+    // Add the comma separated IDs of list, false if one is not an integer
+    bool add_fields(const std::string& list);
+    bool add_categories(const std::string& list);
+    // Add the field IDs in file, separated by white space or commas. Lines
+    // starting with # are comments
+    void add_field_file(const std::string& file);
+    // Add the fields of the categories given, DATA_META must be written
+    void resolve(sqlite3* db);
+    bool active() const { return m_active; }
+    bool contains(int64_t field) const
+    {
+        return !m_active || m_fields.contains(field);
+    }
+    size_t size() const { return m_fields.size(); }
+
+private:
+    IdRegistry m_fields;
+    std::vector<int64_t> m_categories;
+    bool m_active = false;
+};
+
+#endif // PROCESS_FIELD_SELECTION_H
@@ -0,0 +1,122 @@
+#ifndef PROCESS_GP_DATE_H
+#define PROCESS_GP_DATE_H
+
+#include "misc.hpp"
+#include <cstdint>
+
+// Dates of the primary care records, stored as the number of days since
+// 1970-01-01 so a date window is a range scan over integers.
+// date(date_event * 86400, 'unixepoch') gives the text back. UK Biobank
+// replaces the dates it withholds with placeholders, which are stored as NULL
+// with a flag telling which one it was, see gp_date_flag. Text that is no date
+// at all is flagged too, and kept as it was in date_text
+struct GpDate
+{
+    int64_t day = 0;
+    // 0 for a real date, otherwise the ID of the placeholder in gp_date_flag
+    int flag = 0;
+
+    struct Placeholder
+    {
+        int year;
+        unsigned month;
+        unsigned day;
+        const char* meaning;
+    };
+    // flag i + 1 is placeholders()[i], the first one stands for anything
+    // that is not a date
+    static const Placeholder* placeholders(size_t& num)
+    {
+        static const Placeholder list[] = {
+            {0, 0, 0, "Missing or not a date"},
+            {1900, 1, 1, "Date unknown"},
+            {1901, 1, 1, "Before the date of birth of the participant"},
+            {1902, 2, 2, "On the date of birth of the participant"},
+            {1903, 3, 3, "After birth, in the year of birth"},
+            {2037, 7, 7, "In the future, presumably a system default"}};
+        num = sizeof(list) / sizeof(list[0]);
+        return list;
+    }
+
+    // Parse dd/mm/yyyy or yyyy-mm-dd
+    static GpDate parse(const misc::string_view& text)
+    {
+        GpDate date;
+        date.flag = 1;
+        if (text.size() != 10) return date;
+        const char* p = text.data();
+        int year;
+        unsigned month, day;
+        if (p[2] == '/' && p[5] == '/')
+        {
+            if (!digits(p, 2, day) || !digits(p + 3, 2, month)
+                || !digits(p + 6, 4, year))
+                return date;
+        }
+        else if (p[4] == '-' && p[7] == '-')
+        {
+            if (!digits(p, 4, year) || !digits(p + 5, 2, month)
+                || !digits(p + 8, 2, day))
+                return date;
+        }
+        else
+        {
+            return date;
+        }
+        if (month < 1 || month > 12 || day < 1
+            || day > days_in_month(year, month))
+            return date;
+        size_t num;
+        const Placeholder* list = placeholders(num);
+        for (size_t i = 1; i < num; ++i)
+        {
+            if (list[i].year == year && list[i].month == month
+                && list[i].day == day)
+            {
+                date.flag = static_cast<int>(i + 1);
+                return date;
+            }
+        }
+        date.flag = 0;
+        date.day = days_from_civil(year, month, day);
+        return date;
+    }
+
+    // days since 1970-01-01 of a date of the proleptic Gregorian calendar
+    static int64_t days_from_civil(int64_t year, unsigned month, unsigned day)
+    {
+        // years start in March, so the leap day is the last of the year
+        year -= month <= 2;
+        const int64_t era = (year >= 0 ? year : year - 399) / 400;
+        const unsigned year_of_era = static_cast<unsigned>(year - era * 400);
+        const unsigned day_of_year =
+            (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+        const unsigned day_of_era = year_of_era * 365 + year_of_era / 4
+                                    - year_of_era / 100 + day_of_year;
+        return era * 146097 + static_cast<int64_t>(day_of_era) - 719468;
+    }
+
+private:
+    template <typename T>
+    static bool digits(const char* p, size_t num, T& value)
+    {
+        value = 0;
+        for (size_t i = 0; i < num; ++i)
+        {
+            const unsigned digit = static_cast<unsigned char>(p[i] - '0');
+            if (digit > 9) return false;
+            value = value * 10 + static_cast<T>(digit);
+        }
+        return true;
+    }
+    static unsigned days_in_month(int year, unsigned month)
+    {
+        static const unsigned days[] = {31, 28, 31, 30, 31, 30,
+                                        31, 31, 30, 31, 30, 31};
+        const bool leap =
+            (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+        return days[month - 1] + (month == 2 && leap ? 1 : 0);
+    }
+};
+
+#endif // PROCESS_GP_DATE_H
@@ -0,0 +1,147 @@
+#ifndef PROCESS_ID_REGISTRY_H
+#define PROCESS_ID_REGISTRY_H
+
+#include "misc.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Set of the participant (or coding) IDs loaded so far. UK Biobank IDs are
+// dense 7 digit integers, so each is one bit of a bitmap over the range seen,
+// found without hashing or allocating. IDs that would stretch the bitmap past
+// max_span bits, and IDs that are not integers at all, are kept in hash sets
+// on the side. Lookups change nothing, so threads can share a registry as
+// long as nobody adds to it
+class IdRegistry
+{
+public:
+    // Add id, return true if it was not in yet
+    bool insert(int64_t id)
+    {
+        if (!in_bitmap(id) && !cover(id))
+        {
+            if (!m_sparse.insert(id).second) return false;
+            ++m_size;
+            return true;
+        }
+        uint64_t& word = m_bits[word_of(id)];
+        const uint64_t bit = bit_of(id);
+        if (word & bit) return false;
+        word |= bit;
+        ++m_size;
+        return true;
+    }
+    bool insert(const misc::string_view& id)
+    {
+        long long value;
+        if (misc::parse_int(id, value)) return insert(value);
+        if (!m_text.insert(id.to_string()).second) return false;
+        ++m_size;
+        return true;
+    }
+    bool contains(int64_t id) const
+    {
+        if (in_bitmap(id)) return (m_bits[word_of(id)] & bit_of(id)) != 0;
+        return m_sparse.find(id) != m_sparse.end();
+    }
+    bool contains(const misc::string_view& id) const
+    {
+        long long value;
+        if (misc::parse_int(id, value)) return contains(value);
+        return m_text.find(id.to_string()) != m_text.end();
+    }
+    size_t size() const { return m_size; }
+    // the integer IDs, in ascending order
+    std::vector<int64_t> sorted() const
+    {
+        std::vector<int64_t> ids;
+        ids.reserve(m_size);
+        for (size_t i = 0; i < m_bits.size(); ++i)
+        {
+            for (uint64_t word = m_bits[i]; word != 0; word &= word - 1)
+            {
+                ids.push_back(m_base + static_cast<int64_t>(64 * i)
+                              + __builtin_ctzll(word));
+            }
+        }
+        if (!m_sparse.empty())
+        {
+            ids.insert(ids.end(), m_sparse.begin(), m_sparse.end());
+            std::sort(ids.begin(), ids.end());
+        }
+        return ids;
+    }
+
+private:
+    // 16MB of bitmap, enough for every ID below 134 million
+    static const int64_t max_span = int64_t(1) << 27;
+    // IDs further out never go in the bitmap, so distances cannot overflow
+    static const int64_t max_id = int64_t(1) << 61;
+    static int64_t floor64(int64_t id) { return id - (((id % 64) + 64) % 64); }
+    bool in_bitmap(int64_t id) const
+    {
+        // below m_base the difference wraps around to a huge offset
+        return static_cast<uint64_t>(id) - static_cast<uint64_t>(m_base)
+               < 64 * m_bits.size();
+    }
+    size_t word_of(int64_t id) const
+    {
+        return static_cast<size_t>((id - m_base) / 64);
+    }
+    static uint64_t bit_of(int64_t id)
+    {
+        return uint64_t(1) << (((id % 64) + 64) % 64);
+    }
+    // Grow the bitmap so it covers id, return false if it would get too big
+    bool cover(int64_t id)
+    {
+        if (id > max_id || id < -max_id) return false;
+        const int64_t start = floor64(id);
+        if (m_bits.empty())
+        {
+            m_base = start;
+            m_bits.assign(1, 0);
+            return true;
+        }
+        const int64_t end = m_base + static_cast<int64_t>(64 * m_bits.size());
+        const int64_t low = std::min(m_base, start),
+                      high = std::max(end, start + 64);
+        if (high - low > max_span) return false;
+        if (low < m_base)
+        {
+            // leave room below as well, so IDs seen in descending order do
+            // not move the bitmap every time
+            const int64_t room =
+                std::min(static_cast<int64_t>(64 * m_bits.size()),
+                         max_span - (high - low));
+            const int64_t num_word = (m_base - floor64(low - room)) / 64;
+            m_bits.insert(m_bits.begin(), static_cast<size_t>(num_word), 0);
+            m_base -= 64 * num_word;
+        }
+        else
+        {
+            m_bits.resize(static_cast<size_t>((high - m_base) / 64), 0);
+        }
+        // IDs set aside earlier may fall in the new range
+        for (auto it = m_sparse.begin(); it != m_sparse.end();)
+        {
+            if (!in_bitmap(*it))
+            {
+                ++it;
+                continue;
+            }
+            m_bits[word_of(*it)] |= bit_of(*it);
+            it = m_sparse.erase(it);
+        }
+        return true;
+    }
+    int64_t m_base = 0;
+    std::vector<uint64_t> m_bits;
+    std::unordered_set<int64_t> m_sparse;
+    std::unordered_set<std::string> m_text;
+    size_t m_size = 0;
+};
+
+#endif // PROCESS_ID_REGISTRY_H
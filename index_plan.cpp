@@ -0,0 +1,140 @@
+#include "index_plan.h"
+#include "misc.hpp"
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+
+namespace
+{
+sqlite3_int64 pragma_value(sqlite3* db, const char* pragma)
+{
+    sqlite3_stmt* statement = nullptr;
+    sqlite3_int64 value = 0;
+    if (sqlite3_prepare_v2(db, pragma, -1, &statement, nullptr) == SQLITE_OK
+        && sqlite3_step(statement) == SQLITE_ROW)
+    { value = sqlite3_column_int64(statement, 0); }
+    sqlite3_finalize(statement);
+    return value;
+}
+}
+
+IndexPlan::IndexPlan(const std::string& profile)
+{
+    if (profile == "minimal") { m_profile = Profile::Minimal; }
+    else if (profile == "extraction")
+    {
+        m_profile = Profile::Extraction;
+    }
+    else if (profile == "full")
+    {
+        m_profile = Profile::Full;
+    }
+    else
+    {
+        m_profile = Profile::Custom;
+        for (auto&& name : misc::split(profile, ","))
+        { m_names.insert(misc::trimmed(name)); }
+    }
+}
+
+void IndexPlan::add(Profile level, const std::string& table,
+                    const std::string& name,
+                    const std::vector<std::string>& columns)
+{
+    m_indexes.push_back(Index {level, table, name, columns});
+}
+
+bool IndexPlan::exists(sqlite3* db, const std::string& name)
+{
+    sqlite3_stmt* statement = nullptr;
+    bool found = false;
+    if (sqlite3_prepare_v2(db,
+                           "SELECT 1 FROM sqlite_master WHERE type = 'index' "
+                           "AND name = ?",
+                           -1, &statement, nullptr)
+        == SQLITE_OK)
+    {
+        sqlite3_bind_text(statement, 1, name.c_str(), -1, SQLITE_STATIC);
+        found = sqlite3_step(statement) == SQLITE_ROW;
+    }
+    sqlite3_finalize(statement);
+    return found;
+}
+
+bool IndexPlan::selected(const Index& index) const
+{
+    if (m_profile == Profile::Custom)
+    { return m_names.find(index.name) != m_names.end(); }
+    return static_cast<int>(index.level) <= static_cast<int>(m_profile);
+}
+
+void IndexPlan::build(sqlite3* db, size_t num_thread)
+{
+    if (m_profile == Profile::Custom)
+    {
+        for (auto&& name : m_names)
+        {
+            bool found = false;
+            for (auto&& index : m_indexes) found |= (index.name == name);
+            if (!found)
+            {
+                fprintf(stderr, "Warning: Unknown index (%s), ignored\n",
+                        name.c_str());
+            }
+        }
+    }
+    // the sorter of CREATE INDEX can use worker threads, if SQLite was built
+    // with them
+    const std::string threads =
+        "PRAGMA threads = " + std::to_string(num_thread);
+    sqlite3_exec(db, threads.c_str(), nullptr, nullptr, nullptr);
+    const sqlite3_int64 page_size = pragma_value(db, "PRAGMA page_size");
+    std::cerr << std::endl
+              << "============================================================"
+              << std::endl;
+    std::cerr << "Start building indexes using "
+              << pragma_value(db, "PRAGMA threads") << " sorter thread(s)"
+              << std::endl;
+    double total_second = 0;
+    sqlite3_int64 total_page = 0;
+    for (auto&& index : m_indexes)
+    {
+        if (!selected(index)) continue;
+        if (exists(db, index.name))
+        {
+            // left by an earlier run, SQLite kept it up to date while we
+            // appended
+            fprintf(stderr, "  %-32s %8s\n", index.name.c_str(), "kept");
+            continue;
+        }
+        std::string sql = "CREATE INDEX '" + index.name + "' ON '"
+                          + index.table + "' (";
+        for (size_t i = 0; i < index.columns.size(); ++i)
+        { sql += (i == 0 ? "'" : ",'") + index.columns[i] + "'"; }
+        sql += ")";
+        const sqlite3_int64 page_before = pragma_value(db, "PRAGMA page_count");
+        const auto start = std::chrono::steady_clock::now();
+        char* zErrMsg = nullptr;
+        if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &zErrMsg)
+            != SQLITE_OK)
+        {
+            std::string error = zErrMsg;
+            sqlite3_free(zErrMsg);
+            throw std::runtime_error("SQL error: " + error);
+        }
+        const double second = std::chrono::duration<double>(
+                                  std::chrono::steady_clock::now() - start)
+                                  .count();
+        // the index is written at the end of the file, the growth of the
+        // file is its size
+        const sqlite3_int64 page =
+            pragma_value(db, "PRAGMA page_count") - page_before;
+        total_second += second;
+        total_page += page;
+        fprintf(stderr, "  %-32s %8.2fs %10.2f MB\n", index.name.c_str(),
+                second, static_cast<double>(page * page_size) / 1048576.0);
+    }
+    fprintf(stderr, "  %-32s %8.2fs %10.2f MB\n", "Total", total_second,
+            static_cast<double>(total_page * page_size) / 1048576.0);
+}
@@ -0,0 +1,51 @@
+#ifndef PROCESS_INDEX_PLAN_H
+#define PROCESS_INDEX_PLAN_H
+
+#include <sqlite3.h>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Indexes are not built while loading. Each loader registers the indexes of its
+// tables here, tagged with the smallest profile that wants them, and all of
+// them are built in one go once every table is filled
+class IndexPlan
+{
+public:
+    enum class Profile
+    {
+        // only what is needed to decode stored values
+        Minimal,
+        // also what field and code lookups need
+        Extraction,
+        // everything
+        Full,
+        // indexes listed by name
+        Custom
+    };
+    // profile is minimal, extraction, full or a comma separated list of index
+    // names
+    explicit IndexPlan(const std::string& profile);
+    void add(Profile level, const std::string& table, const std::string& name,
+             const std::vector<std::string>& columns);
+    // Build the indexes of the profile, letting SQLite sort with num_thread
+    // threads, and report the time and size of each. Indexes already in the
+    // database (e.g. when appending) are kept as they are
+    void build(sqlite3* db, size_t num_thread);
+
+private:
+    struct Index
+    {
+        Profile level;
+        std::string table;
+        std::string name;
+        std::vector<std::string> columns;
+    };
+    bool selected(const Index& index) const;
+    static bool exists(sqlite3* db, const std::string& name);
+    std::vector<Index> m_indexes;
+    std::unordered_set<std::string> m_names;
+    Profile m_profile = Profile::Full;
+};
+
+#endif // PROCESS_INDEX_PLAN_H
@@ -0,0 +1,226 @@
+#include "line_source.h"
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool LineSource::open(const std::string& name, size_t num_thread)
+{
+    close();
+    m_fd = (name == "-") ? STDIN_FILENO : ::open(name.c_str(), O_RDONLY);
+    if (m_fd == -1) return false;
+    char magic[Decompressor::magic_size];
+    size_t num_magic = 0;
+    struct stat info;
+    if (fstat(m_fd, &info) == 0 && S_ISREG(info.st_mode))
+    {
+        m_size = info.st_size;
+        if (m_size == 0)
+        {
+            m_eof = true;
+            return true;
+        }
+        const ssize_t num_peek = pread(m_fd, magic, sizeof(magic), 0);
+        num_magic = num_peek > 0 ? static_cast<size_t>(num_peek) : 0;
+        m_format = Decompressor::detect(magic, num_magic);
+        void* map = (m_format != Decompressor::Format::None)
+                        ? MAP_FAILED
+                        : mmap(nullptr, static_cast<size_t>(m_size), PROT_READ,
+                               MAP_PRIVATE, m_fd, 0);
+        if (map != MAP_FAILED)
+        {
+            // we only ever walk forward, let the kernel read ahead
+            // aggressively and drop pages behind us
+            madvise(map, static_cast<size_t>(m_size), MADV_SEQUENTIAL);
+            m_map = static_cast<const char*>(map);
+            return true;
+        }
+        // pread did not move the file offset, read from the start
+        num_magic = 0;
+    }
+    else
+    {
+        // a pipe cannot be peeked, the bytes read here are handed on to
+        // whoever reads the rest
+        while (num_magic < sizeof(magic))
+        {
+            const ssize_t num_read =
+                read(m_fd, magic + num_magic, sizeof(magic) - num_magic);
+            if (num_read == -1 && errno == EINTR) continue;
+            if (num_read <= 0) break;
+            num_magic += static_cast<size_t>(num_read);
+        }
+        m_format = Decompressor::detect(magic, num_magic);
+    }
+    // not a regular file, compressed or cannot be mapped, stream it instead
+    m_buffer.resize(1024 * 1024);
+    if (m_format != Decompressor::Format::None)
+    {
+        m_decompressor.reset(
+            new Decompressor(m_fd, m_format,
+                             std::vector<char>(magic, magic + num_magic),
+                             num_thread));
+        m_format = m_decompressor->format();
+        return true;
+    }
+    std::copy(magic, magic + num_magic, m_buffer.begin());
+    m_buffer_end = num_magic;
+    return true;
+}
+
+void LineSource::close()
+{
+    // stop the decompressor before its input goes away
+    m_decompressor.reset();
+    if (m_map != nullptr)
+    { munmap(const_cast<char*>(m_map), static_cast<size_t>(m_size)); }
+    if (m_fd != -1 && m_fd != STDIN_FILENO) ::close(m_fd);
+    m_map = nullptr;
+    m_fd = -1;
+    m_size = -1;
+    m_consumed = 0;
+    m_buffer_begin = m_buffer_end = 0;
+    m_eof = false;
+    m_format = Decompressor::Format::None;
+    m_buffer.clear();
+}
+
+ssize_t LineSource::read_input(char* dest, size_t size)
+{
+    if (m_decompressor)
+    { return static_cast<ssize_t>(m_decompressor->read(dest, size)); }
+    ssize_t num_read;
+    do
+    {
+        num_read = read(m_fd, dest, size);
+    } while (num_read == -1 && errno == EINTR);
+    return num_read;
+}
+
+bool LineSource::fill_buffer()
+{
+    if (m_eof) return false;
+    // move the partial line to the front, and grow if a single line does not
+    // fit in the buffer
+    if (m_buffer_begin != 0)
+    {
+        std::copy(m_buffer.begin() + static_cast<long>(m_buffer_begin),
+                  m_buffer.begin() + static_cast<long>(m_buffer_end),
+                  m_buffer.begin());
+        m_buffer_end -= m_buffer_begin;
+        m_buffer_begin = 0;
+    }
+    if (m_buffer_end == m_buffer.size()) m_buffer.resize(m_buffer.size() * 2);
+    const ssize_t num_read = read_input(m_buffer.data() + m_buffer_end,
+                                        m_buffer.size() - m_buffer_end);
+    if (num_read < 0)
+    { throw std::runtime_error("Error: Failed to read from input stream"); }
+    if (num_read == 0)
+    {
+        m_eof = true;
+        return false;
+    }
+    m_buffer_end += static_cast<size_t>(num_read);
+    return true;
+}
+
+bool LineSource::next(misc::string_view& line)
+{
+    if (m_map != nullptr)
+    {
+        const size_t total = static_cast<size_t>(m_size);
+        if (m_consumed >= total) return false;
+        const char* begin = m_map + m_consumed;
+        const size_t remain = total - static_cast<size_t>(m_consumed);
+        const char* end = static_cast<const char*>(memchr(begin, '\n', remain));
+        const size_t length =
+            (end == nullptr) ? remain : static_cast<size_t>(end - begin);
+        line = misc::string_view(begin, length);
+        m_consumed += length + (end == nullptr ? 0 : 1);
+        return true;
+    }
+    if (m_fd == -1) return false;
+    size_t searched = m_buffer_begin;
+    while (true)
+    {
+        const char* begin = m_buffer.data() + searched;
+        const char* end = static_cast<const char*>(
+            memchr(begin, '\n', m_buffer_end - searched));
+        if (end != nullptr)
+        {
+            const size_t length =
+                static_cast<size_t>(end - m_buffer.data()) - m_buffer_begin;
+            line = misc::string_view(m_buffer.data() + m_buffer_begin, length);
+            m_buffer_begin += length + 1;
+            m_consumed += length + 1;
+            return true;
+        }
+        // fill_buffer moves the partial line to the front of the buffer
+        const size_t scanned = m_buffer_end - m_buffer_begin;
+        if (!fill_buffer())
+        {
+            if (m_buffer_begin == m_buffer_end) return false;
+            // last line without a line break
+            const size_t length = m_buffer_end - m_buffer_begin;
+            line = misc::string_view(m_buffer.data() + m_buffer_begin, length);
+            m_buffer_begin = m_buffer_end;
+            m_consumed += length;
+            return true;
+        }
+        searched = m_buffer_begin + scanned;
+    }
+}
+
+void LineSource::skip_to(unsigned long long offset)
+{
+    // a mapped file can jump straight there, if it is the start of a line
+    if (m_map != nullptr && offset > m_consumed
+        && offset <= static_cast<unsigned long long>(m_size)
+        && m_map[offset - 1] == '\n')
+    { m_consumed = offset; }
+    misc::string_view line;
+    while (m_consumed < offset && next(line)) {}
+    if (m_consumed != offset)
+    {
+        throw std::runtime_error("Error: Input ended or changed before offset "
+                                 + std::to_string(offset));
+    }
+}
+
+bool LineSource::next_record(misc::string_view& record)
+{
+    if (!next(record)) return false;
+    // quotes inside a quoted field are doubled, so we are still within a
+    // field as long as we have seen an odd number of them
+    size_t quotes =
+        static_cast<size_t>(std::count(record.begin(), record.end(), '\"'));
+    if (quotes % 2 == 0) return true;
+    const char* begin = record.data();
+    const bool contiguous = stable();
+    if (!contiguous) m_record.assign(record.begin(), record.end());
+    misc::string_view line;
+    while (quotes % 2 != 0)
+    {
+        if (!next(line))
+        {
+            throw std::runtime_error(
+                "Error: Input ended within a quoted field");
+        }
+        quotes +=
+            static_cast<size_t>(std::count(line.begin(), line.end(), '\"'));
+        if (!contiguous)
+        {
+            m_record.push_back('\n');
+            m_record.insert(m_record.end(), line.begin(), line.end());
+        }
+    }
+    // lines of a mapped file follow one another, the record is simply the
+    // span from the first to the last line
+    record = contiguous
+                 ? misc::string_view(begin,
+                                     static_cast<size_t>(line.end() - begin))
+                 : misc::string_view(m_record.data(), m_record.size());
+    return true;
+}
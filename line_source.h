@@ -0,0 +1,74 @@
+#ifndef PROCESS_LINE_SOURCE_H
+#define PROCESS_LINE_SOURCE_H
+
+#include "decompress.h"
+#include "misc.hpp"
+#include <memory>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+// Read a text file one line at a time without copying the lines. Regular
+// files are memory mapped and read sequentially, anything else (pipes,
+// process substitution, "-" for stdin) is streamed through an internal buffer.
+// gzip and zstd input is recognized by its first bytes and decompressed on a
+// background thread, or a pool of them for block compressed input, into the
+// same buffer
+class LineSource
+{
+public:
+    LineSource() {}
+    ~LineSource() { close(); }
+    LineSource(const LineSource&) = delete;
+    LineSource& operator=(const LineSource&) = delete;
+    // return false if the file cannot be opened. num_thread threads
+    // decompress BGZF and seekable zstd input
+    bool open(const std::string& name, size_t num_thread = 1);
+    void close();
+    bool is_open() const { return m_fd != -1; }
+    // Get the next line without its line break. Return false at end of file.
+    // When stable() the view is valid until the source is closed, otherwise
+    // only until the next call to next()
+    bool next(misc::string_view& line);
+    // Get the next CSV record, which runs over several lines when a quoted
+    // field holds a line break. Same lifetime as the view from next()
+    bool next_record(misc::string_view& record);
+    bool stable() const
+    {
+        return m_map != nullptr || (m_size == 0 && !m_decompressor);
+    }
+    // number of bytes consumed so far, for progress report. For compressed
+    // input this counts compressed bytes, to go with size()
+    unsigned long long tell() const
+    {
+        return m_decompressor ? m_decompressor->compressed_consumed()
+                              : m_consumed;
+    }
+    // bytes of (uncompressed) input returned as lines so far, where a
+    // resumed load has to pick up from
+    unsigned long long offset() const { return m_consumed; }
+    // Move on to offset, which must be the start of a line at or after the
+    // current one. Streams are read up to it
+    void skip_to(unsigned long long offset);
+    // total size of the input file, -1 if unknown (e.g. pipe)
+    signed long long size() const { return m_size; }
+    Decompressor::Format format() const { return m_format; }
+
+private:
+    bool fill_buffer();
+    ssize_t read_input(char* dest, size_t size);
+    std::vector<char> m_buffer;
+    // a record spanning lines of a stream has to be pieced together here
+    std::vector<char> m_record;
+    std::unique_ptr<Decompressor> m_decompressor;
+    Decompressor::Format m_format = Decompressor::Format::None;
+    const char* m_map = nullptr;
+    size_t m_buffer_begin = 0;
+    size_t m_buffer_end = 0;
+    unsigned long long m_consumed = 0;
+    signed long long m_size = -1;
+    int m_fd = -1;
+    bool m_eof = false;
+};
+
+#endif // PROCESS_LINE_SOURCE_H
@@ -0,0 +1,203 @@
+#include "load_progress.h"
+#include "misc.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <sys/stat.h>
+
+namespace
+{
+// Journal bytes each entry, or each byte of input, can add to a transaction.
+// Measured appending phenotype entries to a database whose indexes already
+// exist, so every entry dirties index pages all over (about 400 bytes an
+// entry, at 7 bytes of input an entry), and rounded up
+const unsigned long long memory_per_entry = 512;
+const unsigned long long memory_per_byte = 64;
+
+// peak resident size of the process in bytes, 0 if unknown
+unsigned long long peak_resident()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+        { return std::strtoull(line.c_str() + 6, nullptr, 10) * 1024; }
+    }
+    return 0;
+}
+
+void exec(sqlite3* db, const char* sql)
+{
+    char* zErrMsg = nullptr;
+    if (sqlite3_exec(db, sql, nullptr, nullptr, &zErrMsg) != SQLITE_OK)
+    {
+        std::string error = zErrMsg ? zErrMsg : "unknown error";
+        sqlite3_free(zErrMsg);
+        throw std::runtime_error("SQL error: " + error);
+    }
+}
+
+sqlite3_stmt* prepare(sqlite3* db, const char* sql)
+{
+    sqlite3_stmt* statement = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &statement, nullptr) != SQLITE_OK)
+    {
+        throw std::runtime_error("Error: Failed to prepare statement for "
+                                 "LOAD_PROGRESS: "
+                                 + std::string(sqlite3_errmsg(db)));
+    }
+    return statement;
+}
+
+void step(sqlite3* db, sqlite3_stmt* statement)
+{
+    const int status = sqlite3_step(statement);
+    sqlite3_finalize(statement);
+    if (status != SQLITE_DONE)
+    {
+        throw std::runtime_error("Error: Failed to update LOAD_PROGRESS: "
+                                 + std::string(sqlite3_errmsg(db)));
+    }
+}
+}
+
+LoadProgress::LoadProgress(sqlite3* db, unsigned long long chunk_entries,
+                           unsigned long long chunk_bytes, bool resume)
+    : m_db(db)
+    , m_chunk_entries(chunk_entries)
+    , m_chunk_bytes(chunk_bytes)
+    , m_resume(resume)
+{
+    exec(m_db, "CREATE TABLE IF NOT EXISTS LOAD_PROGRESS("
+               "Input TEXT PRIMARY KEY NOT NULL,"
+               "Size INT NOT NULL,"
+               "Modified INT NOT NULL,"
+               "Offset INT NOT NULL,"
+               "Rows INT NOT NULL,"
+               "Entries INT NOT NULL,"
+               "Done BOOLEAN NOT NULL);");
+}
+
+bool LoadProgress::parse_chunk(const std::string& text,
+                               unsigned long long& entries,
+                               unsigned long long& bytes)
+{
+    unsigned long long number, unit;
+    if (!misc::parse_size(text, number, unit)) return false;
+    entries = (unit == 1) ? number : 0;
+    bytes = (unit == 1) ? 0 : number * unit;
+    return true;
+}
+
+unsigned long long LoadProgress::chunk_memory() const
+{
+    if (m_chunk_entries != 0) return m_chunk_entries * memory_per_entry;
+    return m_chunk_bytes * memory_per_byte;
+}
+
+void LoadProgress::report(const std::string& loader)
+{
+    const double sqlite_mb =
+        static_cast<double>(sqlite3_memory_highwater(1)) / 1048576.0;
+    const double resident_mb = static_cast<double>(peak_resident()) / 1048576.0;
+    fprintf(stderr, "Peak memory of %s: %.1f MB in SQLite, %.1f MB resident\n",
+            loader.c_str(), sqlite_mb, resident_mb);
+    // Linux resets the peak resident size on request
+    std::ofstream clear("/proc/self/clear_refs");
+    clear << "5" << std::endl;
+}
+
+LoadProgress::State LoadProgress::start(const std::string& input)
+{
+    // a pipe has no identity to check, it must simply be the same stream
+    sqlite3_int64 size = -1, modified = 0;
+    struct stat info;
+    if (input != "-" && stat(input.c_str(), &info) == 0)
+    {
+        size = static_cast<sqlite3_int64>(info.st_size);
+        modified = static_cast<sqlite3_int64>(info.st_mtime);
+    }
+    m_pending = 0;
+    m_chunk_start = 0;
+    State state;
+    if (m_resume)
+    {
+        sqlite3_stmt* find = prepare(m_db,
+                                     "SELECT Size, Modified, Offset, Rows, "
+                                     "Entries, Done FROM LOAD_PROGRESS "
+                                     "WHERE Input = ?");
+        sqlite3_bind_text(find, 1, input.c_str(), -1, SQLITE_TRANSIENT);
+        if (sqlite3_step(find) == SQLITE_ROW)
+        {
+            const bool same = sqlite3_column_int64(find, 0) == size
+                              && sqlite3_column_int64(find, 1) == modified;
+            state.offset =
+                static_cast<unsigned long long>(sqlite3_column_int64(find, 2));
+            state.rows =
+                static_cast<unsigned long long>(sqlite3_column_int64(find, 3));
+            state.entries =
+                static_cast<unsigned long long>(sqlite3_column_int64(find, 4));
+            state.done = sqlite3_column_int(find, 5) != 0;
+            state.resumed = true;
+            sqlite3_finalize(find);
+            m_chunk_start = state.offset;
+            if (!same)
+            {
+                throw std::runtime_error(
+                    "Error: " + input
+                    + " changed since the interrupted run, cannot resume");
+            }
+            std::cerr << "Resuming " << input << ": "
+                      << (state.done ? "already loaded"
+                                     : std::to_string(state.rows)
+                                           + " rows ("
+                                           + std::to_string(state.entries)
+                                           + " entries) committed")
+                      << std::endl;
+            return state;
+        }
+        sqlite3_finalize(find);
+    }
+    sqlite3_stmt* insert = prepare(m_db, "INSERT OR REPLACE INTO "
+                                         "LOAD_PROGRESS(Input, Size, Modified, "
+                                         "Offset, Rows, Entries, Done) "
+                                         "VALUES(?, ?, ?, 0, 0, 0, 0)");
+    sqlite3_bind_text(insert, 1, input.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(insert, 2, size);
+    sqlite3_bind_int64(insert, 3, modified);
+    step(m_db, insert);
+    return state;
+}
+
+void LoadProgress::update(const std::string& input, const State& state,
+                          bool done)
+{
+    sqlite3_stmt* statement =
+        prepare(m_db, "UPDATE LOAD_PROGRESS SET Offset = ?, Rows = ?, "
+                      "Entries = ?, Done = ? WHERE Input = ?");
+    sqlite3_bind_int64(statement, 1, static_cast<sqlite3_int64>(state.offset));
+    sqlite3_bind_int64(statement, 2, static_cast<sqlite3_int64>(state.rows));
+    sqlite3_bind_int64(statement, 3,
+                       static_cast<sqlite3_int64>(state.entries));
+    sqlite3_bind_int(statement, 4, done ? 1 : 0);
+    sqlite3_bind_text(statement, 5, input.c_str(), -1, SQLITE_TRANSIENT);
+    step(m_db, statement);
+}
+
+void LoadProgress::commit(const std::string& input, const State& state)
+{
+    update(input, state, false);
+    exec(m_db, "END TRANSACTION");
+    exec(m_db, "BEGIN TRANSACTION");
+    m_pending = 0;
+    m_chunk_start = state.offset;
+}
+
+void LoadProgress::finish(const std::string& input, const State& state)
+{
+    update(input, state, true);
+    m_pending = 0;
+}
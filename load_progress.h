@@ -0,0 +1,75 @@
+#ifndef PROCESS_LOAD_PROGRESS_H
+#define PROCESS_LOAD_PROGRESS_H
+
+#include <sqlite3.h>
+#include <string>
+
+// Loaders commit every chunk of entries, and record with each commit how far
+// the input got in LOAD_PROGRESS: the file (name, size and modification
+// time), the bytes of it loaded, the rows (non-empty lines after the header)
+// those bytes hold and the entries written from them. A phenotype row gives
+// one entry per non-missing cell, a primary care row one entry. The record is
+// written in the same transaction as the entries, so after a crash it tells
+// exactly where to pick up from.
+// Chunks are bounded by entries or by bytes of input, and that bound also
+// sizes the memory a transaction needs for its journal and page cache
+class LoadProgress
+{
+public:
+    struct State
+    {
+        // bytes of the (uncompressed) input already loaded, 0 to start over
+        unsigned long long offset = 0;
+        // input rows and database entries up to offset
+        unsigned long long rows = 0;
+        unsigned long long entries = 0;
+        bool done = false;
+        // the input was started by the run being resumed
+        bool resumed = false;
+    };
+    // Commit after chunk_entries entries or chunk_bytes bytes of input,
+    // whichever comes first, 0 for no limit. With resume, inputs pick up from
+    // their last committed chunk
+    LoadProgress(sqlite3* db, unsigned long long chunk_entries,
+                 unsigned long long chunk_bytes, bool resume);
+    // Parse a chunk size, a number of entries ("1000000") or of bytes with a
+    // K, M or G suffix ("256M"). Return false if it is neither
+    static bool parse_chunk(const std::string& text,
+                            unsigned long long& entries,
+                            unsigned long long& bytes);
+    // Register input, return where to start loading it. Throws when resuming
+    // and the input is not the file the interrupted run was reading
+    State start(const std::string& input);
+    // count entries written since the last commit, with the input read up
+    // to offset, true once a chunk is full
+    bool due(unsigned long long entries, unsigned long long offset)
+    {
+        m_pending += entries;
+        return (m_chunk_entries != 0 && m_pending >= m_chunk_entries)
+               || (m_chunk_bytes != 0 && offset - m_chunk_start >= m_chunk_bytes);
+    }
+    // bytes of journal and dirty pages one chunk can produce, 0 if chunks
+    // are unbounded
+    unsigned long long chunk_memory() const;
+    // Print the peak memory of SQLite (page cache and journal) and of the
+    // whole process since the last report, then start over
+    void report(const std::string& loader);
+    // Record input as loaded up to state.offset, commit the transaction and
+    // begin the next one. The caller must flush its pending inserts first
+    void commit(const std::string& input, const State& state);
+    // record input as completely loaded, in the current transaction
+    void finish(const std::string& input, const State& state);
+    bool resume() const { return m_resume; }
+
+private:
+    void update(const std::string& input, const State& state, bool done);
+    sqlite3* m_db;
+    unsigned long long m_chunk_entries;
+    unsigned long long m_chunk_bytes;
+    unsigned long long m_pending = 0;
+    // offset of the input the current chunk started from
+    unsigned long long m_chunk_start = 0;
+    bool m_resume;
+};
+
+#endif // PROCESS_LOAD_PROGRESS_H
@@ -1,23 +1,181 @@
-﻿#include "misc.hpp"
+﻿#include "alloc_counter.h"
+#include "column_store.h"
+#include "external_sort.h"
+#include "field_catalog.h"
+#include "field_selection.h"
+#include "gp_date.h"
+#include "id_registry.h"
+#include "index_plan.h"
+#include "line_source.h"
+#include "load_progress.h"
+#include "memory_budget.h"
+#include "misc.hpp"
+#include "pheno_tables.h"
+#include "pipeline.h"
+#include "recompress.h"
 #include "sql.h"
+#include "value_dictionary.h"
 #include <algorithm>
 #include <cstdlib>
-#include <fstream>
 #include <getopt.h>
 #include <iostream>
+#include <memory>
 #include <sqlite3.h>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <unistd.h>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
-typedef std::pair<std::string, std::string> pheno_info;
+// What earlier runs left in the database, read before appending to it
+struct ExistingDatabase
+{
+    bool append = false;
+    // layout of PHENOTYPE, new entries must follow it
+    bool encoded = false;
+    bool clustered = false;
+    bool typed = false;
+    IdRegistry fields;
+    IdRegistry participants;
+};
+
+template <typename Row>
+void select_rows(sqlite3* db, const std::string& sql, Row row)
+{
+    sqlite3_stmt* statement = nullptr;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &statement, nullptr)
+        != SQLITE_OK)
+    {
+        const std::string error = sqlite3_errmsg(db);
+        sqlite3_finalize(statement);
+        throw std::runtime_error("Error: Cannot read existing database: "
+                                 + error);
+    }
+    while (sqlite3_step(statement) == SQLITE_ROW) row(statement);
+    sqlite3_finalize(statement);
+}
+
+std::string column_text(sqlite3_stmt* statement, int column)
+{
+    const unsigned char* text = sqlite3_column_text(statement, column);
+    return text ? reinterpret_cast<const char*>(text) : "";
+}
+
+ExistingDatabase read_existing(sqlite3* db, const std::string& db_name,
+                               const bool resume)
+{
+    ExistingDatabase existing;
+    existing.append = true;
+    std::string pheno_sql;
+    bool has_meta = false;
+    std::vector<std::string> indexes;
+    select_rows(db,
+                "SELECT type, name, sql, tbl_name FROM sqlite_master WHERE "
+                "tbl_name IN ('PHENOTYPE', 'PHENO_INTEGER', 'PHENO_REAL', "
+                "'PHENO_TEXT', 'PHENO_META', 'DATA_META')",
+                [&](sqlite3_stmt* row) {
+                    const std::string type = column_text(row, 0),
+                                      name = column_text(row, 1),
+                                      table = column_text(row, 3);
+                    // the typed layout has a PHENOTYPE view over its tables
+                    if (type == "table"
+                        && (name == "PHENOTYPE" || name == "PHENO_INTEGER"))
+                    {
+                        pheno_sql = column_text(row, 2);
+                        existing.typed = (name == "PHENO_INTEGER");
+                    }
+                    existing.encoded |= (type == "table" && name == "PHENO_META");
+                    if (type == "index") indexes.push_back(name);
+                    has_meta |= (type == "table" && name == "DATA_META");
+                });
+    // a run may be interrupted before it got to the phenotype
+    if (pheno_sql.empty() && resume) return existing;
+    if (pheno_sql.empty())
+    {
+        throw std::runtime_error("Error: " + db_name
+                                 + " has no PHENOTYPE table to append to");
+    }
+    existing.clustered = pheno_sql.find("WITHOUT ROWID") != std::string::npos;
+    const std::vector<std::string> tables = PhenoTables::names(existing.typed);
+    bool field_index = true;
+    for (auto&& table : tables)
+    {
+        field_index &= std::find(indexes.begin(), indexes.end(),
+                                 table + "_INSTANCE_FIELD_INDEX")
+                       != indexes.end();
+    }
+    if (existing.clustered || field_index)
+    {
+        // hop from one field to the next through the index, rather than
+        // reading every entry
+        for (auto&& table : tables)
+        {
+            sqlite3_stmt* next = nullptr;
+            sqlite3_prepare_v2(db,
+                               ("SELECT MIN(FieldID) FROM " + table
+                                + " WHERE FieldID > ?")
+                                   .c_str(),
+                               -1, &next, nullptr);
+            sqlite3_int64 field = -1;
+            while (true)
+            {
+                sqlite3_bind_int64(next, 1, field);
+                if (sqlite3_step(next) != SQLITE_ROW
+                    || sqlite3_column_type(next, 0) == SQLITE_NULL)
+                    break;
+                field = sqlite3_column_int64(next, 0);
+                existing.fields.insert(static_cast<int64_t>(field));
+                sqlite3_reset(next);
+            }
+            sqlite3_finalize(next);
+        }
+    }
+    else if (has_meta || !resume)
+    {
+        // without an index on FieldID, trust DATA_META over a full scan.
+        // An interrupted run has yet to write it, and its fields are
+        // reloaded from the start anyway
+        select_rows(db, "SELECT FieldID FROM DATA_META WHERE Included = 1",
+                    [&](sqlite3_stmt* row) {
+                        existing.fields.insert(static_cast<int64_t>(
+                            sqlite3_column_int64(row, 0)));
+                    });
+    }
+    select_rows(db, "SELECT ID FROM PARTICIPANT", [&](sqlite3_stmt* row) {
+        if (sqlite3_column_type(row, 0) == SQLITE_INTEGER)
+        { existing.participants.insert(sqlite3_column_int64(row, 0)); }
+        else
+        {
+            existing.participants.insert(
+                misc::string_view(column_text(row, 0)));
+        }
+    });
+    std::cerr << "Appending to " << db_name << " with "
+              << existing.fields.size() << " field(s) and "
+              << existing.participants.size() << " participant(s) ("
+              << (existing.clustered ? "clustered" : "rowid")
+              << (existing.typed ? ", typed" : "")
+              << (existing.encoded ? ", encoded" : "") << " layout)"
+              << std::endl;
+    return existing;
+}
 
 void print_progress(signed long long cur_loc, signed long long length,
                     double& prev_percentage)
 {
+    if (length <= 0)
+    {
+        // size of a stream is unknown, report the amount read instead
+        const double cur_mb = static_cast<double>(cur_loc) / 1048576.0;
+        if (cur_mb - prev_percentage > 1.0)
+        {
+            fprintf(stderr, "\rProcessed %.0f MB", cur_mb);
+            prev_percentage = cur_mb;
+        }
+        return;
+    }
     double cur_progress =
         (static_cast<double>(cur_loc) / static_cast<double>(length)) * 100.0;
     if (cur_progress - prev_percentage > 0.01)
@@ -31,405 +189,860 @@ void print_progress(signed long long cur_loc, signed long long length,
     }
 }
 
-signed long long get_file_length(std::ifstream& pheno_file)
-{
-    pheno_file.seekg(0, pheno_file.end);
-    signed long long file_length = pheno_file.tellg();
-    pheno_file.clear();
-    pheno_file.seekg(0, pheno_file.beg);
-    return file_length;
-}
-
-void load_code(sqlite3* db, const std::string& code_showcase)
+void load_code(sqlite3* db, const std::string& code_showcase,
+               const bool append, IndexPlan& indexes)
 {
-    std::ifstream code(code_showcase.c_str());
-    if (!code.is_open())
+    LineSource code;
+    if (!code.open(code_showcase))
     {
         throw std::runtime_error("Error: Cannot open code showcase file: "
                                  + code_showcase
                                  + ". Please check you have the correct input");
     }
-    std::string line;
+    misc::string_view view;
     // there is a header
-    auto&& file_length = get_file_length(code);
     std::cerr << std::endl
               << "============================================================"
               << std::endl;
     std::cerr << "Header line of code showcase: " << std::endl;
-    std::getline(code, line);
-    std::cerr << line << std::endl;
+    code.next(view);
+    std::cerr << view.to_string() << std::endl;
     double prev_percentage = 0;
-    std::vector<std::string> token;
-    std::unordered_set<std::string> id;
+    std::vector<misc::string_view> token;
+    std::vector<char> csv_buffer;
+    IdRegistry id;
     SQL code_table("CODE", db);
     SQL code_meta("CODE_META", db);
-    code_table.create_table("CREATE TABLE CODE("
-                            "ID INT PRIMARY KEY NOT NULL);");
-    code_meta.create_table("CREATE TABLE CODE_META("
-                           "ID INT,"
-                           "Value INT NOT NULL,"
-                           "Meaning TEXT,"
-                           "FOREIGN KEY (ID) REFERENCES CODE(ID));");
-    code_table.prep_statement("INSERT INTO CODE(ID) VALUES(@ID)");
-    code_meta.prep_statement(
-        "INSERT INTO CODE_META(ID, Value, Meaning) VALUES(@ID,@V, @M)");
+    // the showcase lists every coding, so an earlier copy is simply replaced
+    if (append && code_table.use_existing())
+    { code_table.execute_sql("DELETE FROM CODE"); }
+    else
+    {
+        code_table.create_table("CREATE TABLE CODE("
+                                "ID INT PRIMARY KEY NOT NULL);");
+    }
+    if (append && code_meta.use_existing())
+    { code_meta.execute_sql("DELETE FROM CODE_META"); }
+    else
+    {
+        code_meta.create_table("CREATE TABLE CODE_META("
+                               "ID INT,"
+                               "Value INT NOT NULL,"
+                               "Meaning TEXT,"
+                               "FOREIGN KEY (ID) REFERENCES CODE(ID));");
+    }
+    code_table.prep_insert("INSERT INTO CODE(ID)", {SQL::Type::Integer});
+    code_meta.prep_insert(
+        "INSERT INTO CODE_META(ID, Value, Meaning)",
+        {SQL::Type::Integer, SQL::Type::Integer, SQL::Type::Text});
     char* zErrMsg = nullptr;
     sqlite3_exec(db, "BEGIN TRANSACTION", nullptr, nullptr, &zErrMsg);
-    while (std::getline(code, line))
+    while (code.next_record(view))
     {
-        misc::trim(line);
-        if (line.empty()) continue;
-        print_progress(code.tellg(), file_length, prev_percentage);
-        // CSV input
-        token = misc::csv_split(line);
+        misc::trim(view);
+        if (view.empty()) continue;
+        print_progress(code.tell(), code.size(), prev_percentage);
+        // CSV input, quotes are already removed by csv_split
+        misc::csv_split(token, view, csv_buffer);
         if (token.size() != 3)
         {
             throw std::runtime_error(
                 "Error: Undefined Code Showcase "
                 "format! File is expected to have exactly 3 columns.\n"
-                + line);
-        }
-        // some fields got comma in it, need to handle it
-        for (size_t i = 3; i < token.size(); ++i)
-        { token[2] = token[2] + "," + token[i]; }
-        // clean up the string, remove all redundent "
-        token[2].erase(std::remove(token[2].begin(), token[2].end(), '\"'),
-                       token[2].end());
-        // add the " back as a protection
-        token[2] = "\"" + token[2] + "\"";
-        if (id.find(token[0]) == id.end())
+                + view.to_string());
+        }
+        if (id.insert(token[0]))
         {
             // ADD this into CODE table
-            code_table.run_statement(std::vector<std::string> {token[0]});
-            id.insert(token[0]);
+            code_table.run_statement(token, 1);
         }
         code_meta.run_statement(token);
     }
     code.close();
+    code_table.flush();
+    code_meta.flush();
     sqlite3_exec(db, "END TRANSACTION", nullptr, nullptr, &zErrMsg);
-    code_meta.create_index("CODE_META_VALUE_INDEX",
-                           std::vector<std::string> {"ID", "Value"});
-    code_meta.create_index("CODE_META_INDEX", std::vector<std::string> {"ID"});
+    indexes.add(IndexPlan::Profile::Minimal, "CODE_META",
+                "CODE_META_VALUE_INDEX", {"ID", "Value"});
+    // prefix of CODE_META_VALUE_INDEX
+    indexes.add(IndexPlan::Profile::Full, "CODE_META", "CODE_META_INDEX",
+                {"ID"});
     fprintf(stderr, "\rProcessing %03.2f%%\n", 100.0);
 }
 
-void load_data(sqlite3* db,
-               const std::unordered_set<std::string>& included_fields,
-               const std::string& data_showcase)
+// Write DATA_META before the phenotype is read, so the ValueType of each
+// field is known to the phenotype loader through catalog. Fields are marked
+// as included if earlier runs loaded them, include_fields() adds the rest
+void load_data(sqlite3* db, const std::string& data_showcase,
+               const IdRegistry& existing_fields, const bool append,
+               FieldCatalog& catalog, IndexPlan& indexes)
 {
-    std::cerr << "Total " << included_fields.size() << " fields to be included"
-              << std::endl;
-    std::ifstream data(data_showcase.c_str());
-    if (!data.is_open())
+    LineSource data;
+    if (!data.open(data_showcase))
     {
         throw std::runtime_error("Error: Cannot open data showcase file: "
                                  + data_showcase
                                  + ". Please check you have the correct input");
     }
-    std::string line;
+    misc::string_view view;
     // there is a header
-    auto&& file_length = get_file_length(data);
     std::cerr << std::endl
               << "============================================================"
               << std::endl;
     std::cerr << "Header line of data showcase: " << std::endl;
-    std::getline(data, line);
-    std::cerr << line << std::endl;
+    data.next(view);
+    std::cerr << view.to_string() << std::endl;
     double prev_percentage = 0;
-    std::vector<std::string> token;
+    std::vector<misc::string_view> token;
+    std::vector<char> csv_buffer;
+    long long field;
     SQL data_meta("DATA_META", db);
-    data_meta.create_table("CREATE TABLE DATA_META("
-                           "Category INT NOT NULL,"
-                           "FieldID INT PRIMARY KEY NOT NULL,"
-                           "Field TEXT NOT NULL,"
-                           "Participants INT NOT NULL,"
-                           "Items INT NOT NULL,"
-                           "Stability TEXT NOT NULL,"
-                           "ValueType TEXT NOT NULL,"
-                           "Units TEXT, "
-                           "ItemType TEXT,"
-                           "Strata TEXT,"
-                           "Sexed TEXT,"
-                           "Instances INT NOT NULL,"
-                           "Array INT NOT NULL,"
-                           "Coding INT,"
-                           "Included BOOLEAN,"
-                           "FOREIGN KEY (Coding) REFERENCES CODE(ID));");
-    data_meta.prep_statement(
+    // rewritten in full, so Included covers the fields of earlier runs too
+    if (append && data_meta.use_existing())
+    { data_meta.execute_sql("DELETE FROM DATA_META"); }
+    else
+    {
+        data_meta.create_table("CREATE TABLE DATA_META("
+                               "Category INT NOT NULL,"
+                               "FieldID INT PRIMARY KEY NOT NULL,"
+                               "Field TEXT NOT NULL,"
+                               "Participants INT NOT NULL,"
+                               "Items INT NOT NULL,"
+                               "Stability TEXT NOT NULL,"
+                               "ValueType TEXT NOT NULL,"
+                               "Units TEXT, "
+                               "ItemType TEXT,"
+                               "Strata TEXT,"
+                               "Sexed TEXT,"
+                               "Instances INT NOT NULL,"
+                               "Array INT NOT NULL,"
+                               "Coding INT,"
+                               "Included BOOLEAN,"
+                               "FOREIGN KEY (Coding) REFERENCES CODE(ID));");
+    }
+    data_meta.prep_insert(
         "INSERT INTO DATA_META(Category, FieldID, Field, Participants, "
         "Items, Stability, ValueType, Units, ItemType, Strata, Sexed, "
-        "Instances, Array, Coding, Included) "
-        "VALUES(@CATEGORY,@FIELDID,@FIELD,@PARTICIPANTS,@ITEM,@STABILITY,"
-        "@VALUETYPE,@UNITS,@ITEMTYPE,@STRATA,@SEXED,@INSTANCES,@ARRAY,@CODING, "
-        "@INCLUDED)");
+        "Instances, Array, Coding, Included)",
+        {SQL::Type::Integer, SQL::Type::Integer, SQL::Type::Text,
+         SQL::Type::Integer, SQL::Type::Integer, SQL::Type::Text,
+         SQL::Type::Text, SQL::Type::Text, SQL::Type::Text, SQL::Type::Text,
+         SQL::Type::Text, SQL::Type::Integer, SQL::Type::Integer,
+         SQL::Type::Integer, SQL::Type::Integer});
     char* zErrMsg = nullptr;
     sqlite3_exec(db, "BEGIN TRANSACTION", nullptr, nullptr, &zErrMsg);
 
-    while (std::getline(data, line))
+    while (data.next_record(view))
     {
-        misc::trim(line);
-        if (line.empty()) continue;
-        print_progress(data.tellg(), file_length, prev_percentage);
-        // CSV input
-        token = misc::csv_split(line);
+        misc::trim(view);
+        if (view.empty()) continue;
+        print_progress(data.tell(), data.size(), prev_percentage);
+        // CSV input, quotes are already removed by csv_split
+        misc::csv_split(token, view, csv_buffer);
         if (token.size() != 17)
         {
             throw std::runtime_error(
                 "Error: Undefined Data Showcase "
                 "format! File is expected to have exactly 17 columns.\n"
-                + line);
-        }
-        for (size_t i = 1; i < 15; ++i)
-        {
-            // we skip the first one and last 2 as they are not as useful
-            // can always retrieve those using data showcase
-            if (i == 3 || (i >= 6 && i <= 11))
-            {
-                token[i].erase(
-                    std::remove(token[i].begin(), token[i].end(), '\"'),
-                    token[i].end());
-                if (token[i] != "NULL") token[i] = "\"" + token[i] + "\"";
-            }
+                + view.to_string());
         }
-        bool field_included =
-            (included_fields.find(token[2]) == included_fields.end());
-        token[15] = field_included ? "0" : "1";
+        // we skip the first one and last 2 as they are not as useful
+        // can always retrieve those using data showcase. Empty cells are
+        // stored as NULL
+        const bool field_included = existing_fields.contains(token[2]);
+        if (misc::parse_int(token[2], field))
+        { catalog.set(field, FieldCatalog::parse(token[7])); }
+        token[15] = misc::string_view(field_included ? "1" : "0", 1);
         data_meta.run_statement(token, 16, 1);
     }
     data.close();
+    data_meta.flush();
     sqlite3_exec(db, "END TRANSACTION", nullptr, nullptr, &zErrMsg);
     fprintf(stderr, "\rProcessing %03.2f%%\n", 100.0);
-    data_meta.create_index("DATA_INDEX", std::vector<std::string> {"FieldID"});
+    // FieldID is the primary key already
+    indexes.add(IndexPlan::Profile::Full, "DATA_META", "DATA_INDEX",
+                {"FieldID"});
+}
+
+// Mark fields as included in DATA_META once the phenotype is in
+void include_fields(sqlite3* db, const IdRegistry& fields)
+{
+    std::cerr << "Total " << fields.size() << " fields to be included"
+              << std::endl;
+    sqlite3_stmt* include = nullptr;
+    if (sqlite3_prepare_v2(db,
+                           "UPDATE DATA_META SET Included = 1 "
+                           "WHERE FieldID = ?",
+                           -1, &include, nullptr)
+        != SQLITE_OK)
+    {
+        const std::string error = sqlite3_errmsg(db);
+        sqlite3_finalize(include);
+        throw std::runtime_error("Error: Cannot update DATA_META: " + error);
+    }
+    char* zErrMsg = nullptr;
+    sqlite3_exec(db, "BEGIN TRANSACTION", nullptr, nullptr, &zErrMsg);
+    for (auto&& field : fields.sorted())
+    {
+        sqlite3_bind_int64(include, 1, static_cast<sqlite3_int64>(field));
+        sqlite3_step(include);
+        sqlite3_reset(include);
+    }
+    sqlite3_exec(db, "END TRANSACTION", nullptr, nullptr, &zErrMsg);
+    sqlite3_finalize(include);
+}
+
+// What to do with a phenotype column
+enum class ColumnAction : uint8_t
+{
+    // a field that is not selected, or that another phenotype file
+    // already loaded
+    Skip,
+    // the participant ID
+    Id,
+    Insert
+};
+
+// What to do with each column of a phenotype file, compiled once from the
+// header so neither the parser nor the writer has to look at strings
+struct PhenoColumn
+{
+    int32_t field = 0;
+    int32_t instance = 0;
+    int32_t array = 0;
+    ValueType type = ValueType::Unknown;
+    PhenoTables::Storage storage = PhenoTables::Storage::Integer;
+    ColumnAction action = ColumnAction::Skip;
+    // store a key into PHENO_META instead of the value
+    bool encode = false;
+    // only insert for participants new to the database
+    bool existing = false;
+};
+
+// Parse the f.<field>.<instance>.<array> name of a phenotype column
+void parse_column_name(const misc::string_view& name, PhenoColumn& column)
+{
+    std::vector<misc::string_view> part;
+    misc::split(part, name, '.');
+    if (part.size() != 4 || part[0] != "f")
+    {
+        throw std::runtime_error("Error: We expect all Field ID "
+                                 "from the phenotype to have the "
+                                 "following format: f.x.x.x: "
+                                 + name.to_string());
+    }
+    int32_t* ids[] = {&column.field, &column.instance, &column.array};
+    for (size_t i = 0; i < 3; ++i)
+    {
+        long long value;
+        if (!misc::parse_int(part[i + 1], value) || value < INT32_MIN
+            || value > INT32_MAX)
+        {
+            throw std::runtime_error("Error: Field ID, instance and array "
+                                     "index must be integers: "
+                                     + name.to_string());
+        }
+        *ids[i] = static_cast<int32_t>(value);
+    }
 }
 
-std::vector<pheno_info> get_pheno_meta(const std::string& pheno,
-                                       std::vector<std::string>& token,
-                                       std::unordered_set<std::string>& fields,
-                                       size_t& id_idx)
+// Compile the header of a phenotype file into its column plan. Fields not
+// selected are skipped, so is a field that an earlier file had, with a
+// warning. The rest are added to fields
+std::vector<PhenoColumn>
+compile_columns(const std::string& pheno, misc::string_view header,
+                IdRegistry& fields, const ExistingDatabase& existing,
+                const FieldCatalog& catalog, const FieldSelection& selection,
+                const bool encode, const bool resumed, size_t& id_idx)
 {
-    std::vector<std::string> subtoken;
-    std::vector<pheno_info> phenotype_meta;
-    std::unordered_set<std::string> processed_field;
-    std::string field_id, instance_num;
+    misc::trim(header);
+    std::vector<misc::string_view> token;
+    misc::split(token, header, '\t');
+    std::vector<PhenoColumn> column_plan(token.size());
+    IdRegistry file_fields;
     for (size_t i = 0; i < token.size(); ++i)
     {
+        misc::string_view name = token[i];
         // remove "
-        token[i].erase(std::remove(token[i].begin(), token[i].end(), '\"'),
-                       token[i].end());
-        if (token[i] == "f.eid")
+        if (!name.empty() && name.front() == '"') name.remove_prefix(1);
+        if (!name.empty() && name.back() == '"') name.remove_suffix(1);
+        PhenoColumn& column = column_plan[i];
+        if (name == "f.eid")
         {
-            phenotype_meta.emplace_back(std::make_pair("0", "0"));
+            column.action = ColumnAction::Id;
             id_idx = i;
+            continue;
         }
-        else
+        parse_column_name(name, column);
+        if (!selection.contains(column.field)) continue;
+        if (!file_fields.contains(column.field)
+            && fields.contains(column.field))
         {
-            // we don't care about the array index
-            subtoken = misc::split(token[i], ".");
-            if (subtoken.size() != 4)
-            {
-                throw std::runtime_error("Error: We expect all Field ID "
-                                         "from the phenotype to have the "
-                                         "following format: f.x.x.x: "
-                                         + token[i]);
-            }
-            // if(pheno_id.find(subtoken[1])==pheno_id.end()){
-            field_id = subtoken[1];
-            instance_num = subtoken[2];
-            if (processed_field.find(field_id) == processed_field.end()
-                && fields.find(field_id) != fields.end())
-            {
-                // When we read the second phentype file, we found that
-                // it was already read, so we should skip it an issue a
-                // warning
-                fprintf(stderr,
-                        "Warning: Duplicated Field ID (%s) detected in %s. "
-                        "We will ignore this instance\n",
-                        token[i].c_str(), pheno.c_str());
-                // use NA to indicate we want this to be ignored
-                phenotype_meta.emplace_back(std::make_pair("NA", instance_num));
-            }
-            else
-            {
-                fields.insert(field_id);
-                phenotype_meta.emplace_back(
-                    std::make_pair(field_id, instance_num));
-                processed_field.insert(field_id);
-            }
+            fprintf(stderr,
+                    "Warning: Duplicated Field ID (%s) detected in %s. "
+                    "We will ignore this instance\n",
+                    name.to_string().c_str(), pheno.c_str());
+            continue;
         }
+        fields.insert(column.field);
+        file_fields.insert(column.field);
+        column.type = catalog.type(column.field);
+        column.action = ColumnAction::Insert;
+        column.encode = encode && FieldCatalog::keyed(column.type);
+        column.storage = PhenoTables::storage(column.type, column.encode);
+        // fields from an earlier run are only wanted for the participants it
+        // did not have. An input the interrupted run had started is not
+        // existing data, its remaining rows are wanted whoever they belong to
+        column.existing = existing.fields.contains(column.field) && !resumed;
     }
-    return phenotype_meta;
+    return column_plan;
 }
 
+// A batch of phenotype lines travels from the reader, through one of the
+// parser threads and on to the database writer. The parser picks out the
+// participant ID of each row and the cells to be inserted, both as views into
+// the lines, so the input must outlive the batch
+struct PhenoBatch
+{
+    size_t seq = 0;
+    signed long long file_loc = 0;
+    // end of the batch in the uncompressed input, to resume from
+    unsigned long long offset = 0;
+    unsigned long long bytes = 0;
+    unsigned long long na_entries = 0;
+    std::vector<misc::string_view> lines;
+    // holds the lines when they cannot be referenced in the input directly
+    std::vector<char> storage;
+    std::vector<misc::string_view> id;
+    // participant of each row as worked out by the parser
+    struct Participant
+    {
+        int64_t id = 0;
+        // the ID is an integer, otherwise there is only its text
+        bool numeric = false;
+        // in the database before this run
+        bool existing = false;
+    };
+    std::vector<Participant> participant;
+    // cells of row i are cells[row_end[i-1]] to cells[row_end[i]-1]
+    std::vector<size_t> row_end;
+    // column index and value of each non-missing cell
+    std::vector<std::pair<size_t, misc::string_view>> cells;
+};
+
+const size_t max_batch_line = 64;
+
+// Number of columns the parser has to split, up to the last one that is not
+// skipped. The columns after it are never looked at
+size_t scan_width(const std::vector<PhenoColumn>& column_plan)
+{
+    size_t num_scan = column_plan.size();
+    while (num_scan > 0
+           && column_plan[num_scan - 1].action == ColumnAction::Skip)
+    { --num_scan; }
+    return num_scan;
+}
 
-size_t get_phenotype_id(
-    SQL& pheno_meta,
-    std::unordered_map<std::string, std::unordered_map<std::string, size_t>>&
-        pheno_id,
-    size_t& pheno_meta_idx, const std::string& field_id,
-    const std::string& pheno)
+void parse_pheno_batch(PhenoBatch& batch,
+                       const std::vector<PhenoColumn>& column_plan,
+                       const size_t num_scan, const size_t id_idx,
+                       const IdRegistry& existing,
+                       std::vector<misc::string_view>& token)
 {
-    auto&& field_loc = pheno_id.find(field_id);
-    if (field_loc != pheno_id.end())
+    const size_t num_pheno = column_plan.size();
+    // with columns left unsplit, only whether a line has enough of them can
+    // be checked
+    const bool partial = num_scan < num_pheno;
+    for (auto&& line : batch.lines)
     {
-        auto&& pheno_loc = field_loc->second.find(pheno);
-        if (pheno_loc != field_loc->second.end()) { return pheno_loc->second; }
+        misc::trim(line);
+        if (line.empty()) continue;
+        // Tab Delim
+        if (partial) { misc::split(token, line, '\t', num_scan); }
         else
         {
-            pheno_id[field_id][pheno] = pheno_meta_idx;
-            pheno_meta.run_statement(std::vector<std::string> {
-                std::to_string(pheno_meta_idx), field_id, pheno});
-            ++pheno_meta_idx;
-            return pheno_meta_idx - 1;
+            misc::split(token, line, '\t');
         }
-    }
-    else
-    {
-        pheno_id[field_id][pheno] = pheno_meta_idx;
-        pheno_meta.run_statement(std::vector<std::string> {
-            std::to_string(pheno_meta_idx), field_id, pheno});
-        ++pheno_meta_idx;
-        return pheno_meta_idx - 1;
+        if (token.size() != num_scan)
+        {
+            throw std::runtime_error(
+                "Error: Undefined Phenotype file"
+                "format! File is expected to have "
+                + std::string(partial ? "at least " : "exactly ")
+                + misc::to_string(partial ? num_scan : num_pheno)
+                + " columns. Line has :" + std::to_string(token.size())
+                + " column(s)\n");
+        }
+        for (size_t i = 0; i < num_scan; ++i)
+        {
+            if (column_plan[i].action != ColumnAction::Insert) continue;
+            const misc::string_view& cell = token[i];
+            const bool na =
+                cell.size() == 2 && cell[0] == 'N' && cell[1] == 'A';
+            batch.na_entries += na;
+            if (!na) batch.cells.emplace_back(i, cell);
+        }
+        batch.id.push_back(token[id_idx]);
+        // nothing adds to the registry of existing participants while the
+        // parsers look in it
+        PhenoBatch::Participant participant;
+        long long id;
+        participant.numeric = misc::parse_int(token[id_idx], id);
+        participant.id = participant.numeric ? id : 0;
+        participant.existing =
+            participant.numeric ? existing.contains(participant.id)
+                                : existing.contains(token[id_idx]);
+        batch.participant.push_back(participant);
+        batch.row_end.push_back(batch.cells.size());
     }
 }
 
-
-void load_phenotype(sqlite3* db, std::unordered_set<std::string>& fields,
-                    const std::vector<std::string> pheno_names,
-                    const bool danger)
+// Load one phenotype file, return how far it got for the progress record
+LoadProgress::State
+load_phenotype_file(sqlite3* db, const std::string& pheno,
+                         PhenoTables& phenotype,
+                         SQL& participants, SQL& pheno_meta,
+                         IdRegistry& fields, const FieldCatalog& catalog,
+                         const FieldSelection& selection, const bool encode,
+                         ValueDictionary& dictionary,
+                         IdRegistry& processed_sample,
+                         const ExistingDatabase& existing,
+                         LoadProgress& progress, MemoryBudget& budget,
+                         ExternalSorter* sorter, const size_t num_thread,
+                         unsigned long long& counts,
+                         unsigned long long& na_entries)
 {
-    SQL phenotype("PHENOTYPE", db);
-    SQL participants("PARTICIPANT", db);
-    phenotype.create_table(
-        "CREATE TABLE PHENOTYPE("
-        "ID INT NOT NULL,"
-        "Instance INT NOT NULL,"
-        "Pheno INT NOT NULL,"
-        "FieldID INT NOT NULL,"
-        "FOREIGN KEY (ID) REFERENCES PARTICIPANT(ID),"
-        "FOREIGN KEY (FieldID) REFERENCES DATA_META(FieldID));");
-    phenotype.prep_statement("INSERT INTO PHENOTYPE"
-                             "(ID, Instance, FieldID, Pheno) "
-                             "VALUES(@S,@I,@F,@P)");
-    // drop out shouldn't even be stored in the database
-    participants.create_table("CREATE TABLE PARTICIPANT("
-                              "ID INT PRIMARY KEY NOT NULL);");
-    participants.prep_statement("INSERT INTO PARTICIPANT(ID) "
-                                "VALUES(@S)");
-    char* zErrMsg = nullptr;
-    if (danger)
+    LoadProgress::State state = progress.start(pheno);
+    LineSource pheno_file;
+    if (!pheno_file.open(pheno, num_thread))
     {
-        sqlite3_exec(db, "PRAGMA synchronous = OFF", nullptr, nullptr,
-                     &zErrMsg);
-        sqlite3_exec(db, "PRAGMA journal_mode = MEMORY", nullptr, nullptr,
-                     &zErrMsg);
+        throw std::runtime_error("Error: Cannot open phenotype file: " + pheno
+                                 + ". Please check you have the correct input");
     }
-
-    // this is easy, but ugly
-    std::unordered_map<std::string, std::unordered_map<std::string, size_t>>
-        pheno_id_dict;
-    std::unordered_set<std::string> processed_sample;
-    size_t pheno_meta_idx = 0;
-    unsigned long long na_entries = 0;
-    unsigned long long counts = 0;
-    std::string field_id, instance_num;
-    sqlite3_exec(db, "BEGIN TRANSACTION", nullptr, nullptr, &zErrMsg);
-    for (auto&& pheno : pheno_names)
+    if (pheno_file.format() != Decompressor::Format::None)
     {
-        std::ifstream pheno_file(pheno.c_str());
-        if (!pheno_file.is_open())
+        std::cerr << "Reading " << Decompressor::name(pheno_file.format())
+                  << " compressed phenotype file" << std::endl;
+    }
+    misc::string_view line;
+    // there is a header
+    const signed long long file_length = pheno_file.size();
+    std::cerr << std::endl
+              << "============================================================"
+              << std::endl;
+    // process the header
+    // should be the Field ID and Instance number
+    size_t id_idx = 0;
+    // pheno meta let us know for this column, what's the Field ID and
+    // what's the instance
+    pheno_file.next(line);
+    const std::vector<PhenoColumn> column_plan =
+        compile_columns(pheno, line, fields, existing, catalog, selection,
+                        encode, state.resumed, id_idx);
+    const size_t num_pheno = column_plan.size();
+    const size_t num_scan = scan_width(column_plan);
+    if (state.done)
+    {
+        std::cerr << pheno << " was loaded by the interrupted run, skipped"
+                  << std::endl;
+        return state;
+    }
+    // rows up to the last committed chunk are already in
+    if (state.offset != 0) pheno_file.skip_to(state.offset);
+    std::cerr << "Start processing phenotype file with " << num_pheno
+              << " entries (" << pheno << ") using " << num_thread
+              << " parser thread(s), " << misc::split_kernel_name()
+              << " tokenizer" << std::endl;
+    if (selection.active())
+    {
+        size_t num_selected = 0;
+        for (auto&& column : column_plan)
+        { num_selected += column.action == ColumnAction::Insert; }
+        std::cerr << num_selected << " column(s) selected, rows are read up "
+                  << "to column " << num_scan << std::endl;
+    }
+    double prev_percentage = 0;
+    fprintf(stderr, "\rProcessing %03.2f%%", 0.00);
+    // one reader feeds a pool of parsers, the current thread is the only one
+    // touching the database and writes the batches back in file order
+    StageStat read_stat("Reader"), parse_stat("Parser"), write_stat("Writer");
+    StageError failure;
+    BoundedQueue<PhenoBatch> parse_queue(2 * num_thread);
+    OrderedQueue<PhenoBatch> write_queue(4 * num_thread, num_thread);
+    // batches queued for or held by the parsers, the reader and the writer
+    // share the memory set aside for them
+    const unsigned long long max_batch_byte =
+        budget.batch_byte(7 * num_thread + 2);
+    std::thread reader([&]() {
+        try
         {
-            throw std::runtime_error(
-                "Error: Cannot open phenotype file: " + pheno
-                + ". Please check you have the correct input");
+            // lines of a mapped file stay put, so the batch only needs to
+            // point at them. Lines of a stream are gone once we read the next
+            // one and are gathered in the batch's own storage instead
+            const bool stable = pheno_file.stable();
+            PhenoBatch batch;
+            std::vector<size_t> line_start;
+            misc::string_view cur_line;
+            auto start = StageStat::clock::now();
+            auto push_batch = [&]() {
+                for (size_t i = 0; i < line_start.size(); ++i)
+                {
+                    batch.lines[i] = misc::string_view(
+                        batch.storage.data() + line_start[i],
+                        batch.lines[i].size());
+                }
+                line_start.clear();
+                batch.file_loc = static_cast<signed long long>(pheno_file.tell());
+                batch.offset = pheno_file.offset();
+                read_stat.add(start, batch.lines.size(), batch.bytes);
+                const size_t seq = batch.seq;
+                if (!parse_queue.push(std::move(batch))) return false;
+                batch = PhenoBatch();
+                batch.seq = seq + 1;
+                start = StageStat::clock::now();
+                return true;
+            };
+            while (pheno_file.next(cur_line))
+            {
+                batch.bytes += cur_line.size() + 1;
+                if (!stable)
+                {
+                    line_start.push_back(batch.storage.size());
+                    batch.storage.insert(batch.storage.end(), cur_line.begin(),
+                                         cur_line.end());
+                }
+                batch.lines.push_back(cur_line);
+                if (batch.lines.size() < max_batch_line
+                    && batch.bytes < max_batch_byte)
+                { continue; }
+                if (!push_batch()) break;
+            }
+            if (!batch.lines.empty()) push_batch();
         }
-        std::string line;
-        // there is a header
-        const signed long long file_length = get_file_length(pheno_file);
-        std::cerr
-            << std::endl
-            << "============================================================"
-            << std::endl;
-        // process the header
-        // should be the Field ID and Instance number
-        size_t id_idx = 0;
-        // pheno meta let us know for this column, what's the Field ID and
-        // what's the instance
-        std::getline(pheno_file, line);
-        std::vector<std::string> token = misc::split(line, "\t");
-        std::vector<pheno_info> phenotype_meta =
-            get_pheno_meta(pheno, token, fields, id_idx);
-        const size_t num_pheno = phenotype_meta.size();
-        std::cerr << "Start processing phenotype file with " << num_pheno
-                  << " entries (" << pheno << ")" << std::endl;
-        double prev_percentage = 0;
-        fprintf(stderr, "\rProcessing %03.2f%%", 0.00);
-        while (std::getline(pheno_file, line))
-        {
-            misc::trim(line);
-            if (line.empty()) continue;
-            print_progress(pheno_file.tellg(), file_length, prev_percentage);
-            // Tab Delim
-            misc::split(token, line, "\t");
-            if (token.size() != num_pheno)
+        catch (...)
+        {
+            failure.set(std::current_exception());
+            write_queue.close();
+        }
+        parse_queue.close();
+    });
+    std::vector<std::thread> parsers;
+    for (size_t thread = 0; thread < num_thread; ++thread)
+    {
+        parsers.emplace_back([&]() {
+            StageStat local_stat("Parser");
+            std::vector<misc::string_view> local_token;
+            PhenoBatch batch;
+            try
+            {
+                while (parse_queue.pop(batch))
+                {
+                    auto start = StageStat::clock::now();
+                    const size_t num_line = batch.lines.size();
+                    parse_pheno_batch(batch, column_plan, num_scan, id_idx,
+                                      existing.participants, local_token);
+                    local_stat.add(start, num_line, batch.bytes);
+                    const size_t seq = batch.seq;
+                    if (!write_queue.push(seq, std::move(batch))) break;
+                }
+            }
+            catch (...)
             {
-                throw std::runtime_error(
-                    "Error: Undefined Phenotype file"
-                    "format! File is expected to have exactly "
-                    + misc::to_string(num_pheno) + " columns. Line has :"
-                    + std::to_string(token.size()) + " column(s)\n");
+                failure.set(std::current_exception());
+                parse_queue.close();
+                write_queue.close();
             }
-            for (size_t i = 0; i < num_pheno; ++i)
+            parse_stat.merge(local_stat);
+            write_queue.done();
+        });
+    }
+    unsigned long long write_alloc = 0, write_row = 0, skipped = 0;
+    try
+    {
+        PhenoBatch batch;
+        int64_t key = 0;
+        EavRecord record;
+        while (write_queue.pop(batch))
+        {
+            auto start = StageStat::clock::now();
+            const unsigned long long alloc_start = alloc_counter::thread_count();
+            const unsigned long long batch_skipped = skipped;
+            size_t cell = 0;
+            for (size_t row = 0; row < batch.id.size(); ++row)
             {
-                if (token[i] == "NA")
+                const misc::string_view& row_id = batch.id[row];
+                const PhenoBatch::Participant& participant =
+                    batch.participant[row];
+                const bool numeric_id = participant.numeric;
+                const int64_t id_num = participant.id;
+                const bool new_sample = !participant.existing;
+                if (numeric_id ? processed_sample.insert(id_num)
+                               : (row_id != "NA"
+                                  && processed_sample.insert(row_id)))
                 {
-                    ++na_entries;
-                    continue;
+                    participants.insert({SQL::Value(row_id, SQL::Type::Integer)});
                 }
-                else if (i == id_idx
-                         && processed_sample.find(token[i])
-                                == processed_sample.end())
+                if (sorter != nullptr && !numeric_id)
                 {
-                    processed_sample.insert(token[i]);
-                    participants.run_statement(token, i + 1, i);
-                    continue;
+                    throw std::runtime_error(
+                        "Error: Participant ID must be an integer when "
+                        "sorting the phenotype: "
+                        + row_id.to_string());
                 }
-                else if (phenotype_meta[i].first == "NA")
+                const SQL::Value id_value =
+                    numeric_id ? SQL::Value(static_cast<sqlite3_int64>(id_num))
+                               : SQL::Value(row_id);
+                for (; cell < batch.row_end[row]; ++cell)
                 {
-                    continue;
+                    auto&& cur = batch.cells[cell];
+                    const PhenoColumn& column = column_plan[cur.first];
+                    if (column.existing && !new_sample)
+                    {
+                        ++skipped;
+                        continue;
+                    }
+                    const PhenoTables::Storage storage =
+                        phenotype.route(column.storage, column.type,
+                                        cur.second);
+                    SQL::Value value(cur.second, phenotype.bind_type(storage));
+                    if (column.encode)
+                    {
+                        if (dictionary.find_or_insert(column.field, cur.second,
+                                                      key))
+                        {
+                            pheno_meta.insert(
+                                {static_cast<sqlite3_int64>(key),
+                                 static_cast<sqlite3_int64>(column.field),
+                                 SQL::Value(cur.second, SQL::Type::Numeric)});
+                        }
+                        value = SQL::Value(static_cast<sqlite3_int64>(key));
+                    }
+                    if (sorter == nullptr)
+                    {
+                        phenotype.insert(storage, id_value,
+                                         column.instance, column.field,
+                                         column.array, value);
+                        continue;
+                    }
+                    record.field = column.field;
+                    record.instance = column.instance;
+                    record.array = column.array;
+                    record.id = id_num;
+                    record.encoded = column.encode;
+                    record.key = column.encode ? key : 0;
+                    record.value = cur.second;
+                    sorter->add(record);
                 }
-                phenotype.run_statement(std::vector<std::string> {
-                    token[id_idx], phenotype_meta[i].second,
-                    phenotype_meta[i].first, token[i]});
-                ++counts;
             }
+            write_alloc += alloc_counter::thread_count() - alloc_start;
+            write_row += batch.id.size();
+            const unsigned long long inserted =
+                batch.cells.size() - (skipped - batch_skipped);
+            state.rows += batch.id.size();
+            state.entries += inserted;
+            state.offset = batch.offset;
+            // a sorter holds on to everything until all files are read,
+            // there is nothing to commit before then. Short of memory, the
+            // journal goes with an early commit, or the run with a spill
+            const bool squeeze = budget.pressure();
+            if (sorter == nullptr
+                && (progress.due(inserted, state.offset) || squeeze))
+            {
+                phenotype.flush();
+                participants.flush();
+                pheno_meta.flush();
+                progress.commit(pheno, state);
+            }
+            if (squeeze)
+            {
+                if (sorter != nullptr) sorter->spill_run();
+                budget.relieve(db);
+            }
+            counts += batch.cells.size();
+            na_entries += batch.na_entries;
+            write_stat.add(start, batch.cells.size());
+            print_progress(batch.file_loc, file_length, prev_percentage);
+        }
+    }
+    catch (...)
+    {
+        failure.set(std::current_exception());
+        parse_queue.close();
+        write_queue.close();
+    }
+    reader.join();
+    for (auto&& parser : parsers) parser.join();
+    failure.rethrow();
+    fprintf(stderr, "\rProcessing %03.2f%%\n", 100.0);
+    // the end of the file, blank lines after the last batch included
+    state.offset = pheno_file.offset();
+    pheno_file.close();
+    read_stat.report("lines");
+    parse_stat.report("lines", num_thread);
+    write_stat.report("entries");
+    fprintf(stderr, "  Writer made %llu heap allocation(s) for %llu rows\n",
+            write_alloc, write_row);
+    if (skipped)
+    {
+        std::cerr << "Skipped " << skipped
+                  << " entries already in the database" << std::endl;
+        counts -= skipped;
+    }
+    return state;
+}
+
+void load_phenotype(sqlite3* db, IdRegistry& fields,
+                    const std::vector<std::string> pheno_names,
+                    const FieldCatalog& catalog,
+                    const FieldSelection& selection, const bool encode,
+                    const size_t num_thread, const bool clustered,
+                    const bool typed,
+                    const bool presort, const std::string& temp_dir,
+                    const ExistingDatabase& existing, LoadProgress& progress,
+                    MemoryBudget& budget, ColumnStore* columns,
+                    IndexPlan& indexes)
+{
+    PhenoTables phenotype(db, typed, clustered);
+    SQL participants("PARTICIPANT", db);
+    SQL pheno_meta("PHENO_META", db);
+    phenotype.prepare(existing.append);
+    // drop out shouldn't even be stored in the database
+    if (!existing.append || !participants.use_existing())
+    {
+        participants.create_table("CREATE TABLE PARTICIPANT("
+                                  "ID INT PRIMARY KEY NOT NULL);");
+    }
+    participants.prep_insert("INSERT INTO PARTICIPANT(ID)",
+                             {SQL::Type::Integer});
+    // with dictionary encoding, Pheno of categorical, text and date fields is
+    // the ID of the value in PHENO_META
+    ValueDictionary dictionary;
+    if (encode && existing.append && pheno_meta.use_existing())
+    {
+        // new values carry on from the keys already handed out
+        select_rows(db, "SELECT ID, FieldID, Value FROM PHENO_META",
+                    [&](sqlite3_stmt* row) {
+                        const std::string value = column_text(row, 2);
+                        dictionary.restore(sqlite3_column_int64(row, 1),
+                                           misc::string_view(value),
+                                           sqlite3_column_int64(row, 0));
+                    });
+    }
+    else if (encode)
+    {
+        pheno_meta.create_table("CREATE TABLE PHENO_META("
+                                "ID INTEGER PRIMARY KEY NOT NULL,"
+                                "FieldID INT NOT NULL,"
+                                "Value NUMERIC NOT NULL,"
+                                "FOREIGN KEY (FieldID) "
+                                "REFERENCES DATA_META(FieldID));");
+    }
+    if (encode)
+    {
+        pheno_meta.prep_insert("INSERT INTO PHENO_META(ID, FieldID, Value)",
+                               {SQL::Type::Integer, SQL::Type::Integer,
+                                SQL::Type::Numeric});
+    }
+    // With presort, cells are sorted into (FieldID, Instance, Array, ID) order
+    // before they go in, so the B-tree pages of the clustered table and of the
+    // field indexes are filled one after another
+    std::unique_ptr<ExternalSorter> sorter;
+    // the column store is written field by field, which needs the same order
+    if (presort || columns != nullptr)
+    {
+        sorter.reset(new ExternalSorter(temp_dir, num_thread,
+                                        budget.run_byte(num_thread)));
+    }
+    char* zErrMsg = nullptr;
+    // participants already in the database are not inserted again
+    IdRegistry processed_sample = existing.participants;
+    unsigned long long na_entries = 0;
+    unsigned long long counts = 0;
+    sqlite3_exec(db, "BEGIN TRANSACTION", nullptr, nullptr, &zErrMsg);
+    std::vector<LoadProgress::State> loaded;
+    for (auto&& pheno : pheno_names)
+    {
+        loaded.push_back(load_phenotype_file(
+            db, pheno, phenotype, participants, pheno_meta, fields, catalog,
+            selection, encode, dictionary, processed_sample, existing,
+            progress, budget, sorter.get(), num_thread, counts, na_entries));
+        if (!sorter && !loaded.back().done)
+        {
+            phenotype.flush();
+            participants.flush();
+            pheno_meta.flush();
+            progress.finish(pheno, loaded.back());
+        }
+    }
+    if (sorter)
+    {
+        sorter->finish();
+        std::cerr << "Inserting " << sorter->num_record()
+                  << " sorted entries merged from " << sorter->num_spill()
+                  << " temporary file(s)" << std::endl;
+        if (columns != nullptr)
+        {
+            columns->start(processed_sample.sorted());
+        }
+        EavRecord record;
+        while (sorter->next(record))
+        {
+            // the sorted entries go in as one transaction, only the cache
+            // can give way
+            if (budget.pressure()) budget.relieve(db);
+            if (columns != nullptr) columns->add(record);
+            const ValueType type = catalog.type(record.field);
+            const PhenoTables::Storage storage = phenotype.route(
+                PhenoTables::storage(type, record.encoded), type,
+                record.value);
+            phenotype.insert(
+                storage, SQL::Value(static_cast<sqlite3_int64>(record.id)),
+                record.instance, record.field, record.array,
+                record.encoded
+                    ? SQL::Value(static_cast<sqlite3_int64>(record.key))
+                    : SQL::Value(record.value, phenotype.bind_type(storage)));
+        }
+        sorter.reset();
+        if (columns != nullptr) columns->finish();
+        // files only count as loaded once their sorted entries are in
+        for (size_t i = 0; i < pheno_names.size(); ++i)
+        {
+            if (loaded[i].done) continue;
+            progress.finish(pheno_names[i], loaded[i]);
         }
-        fprintf(stderr, "\rProcessing %03.2f%%\n", 100.0);
-        pheno_file.close();
     }
+    phenotype.flush();
+    participants.flush();
+    if (encode) pheno_meta.flush();
     sqlite3_exec(db, "END TRANSACTION", nullptr, nullptr, &zErrMsg);
-    std::cerr << "Start building indexs" << std::endl;
-    phenotype.create_index("PHENOTYPE_INDEX", std::vector<std::string> {"ID"});
-    phenotype.create_index("PHENOTYPE_INSTANCE_INDEX",
-                           std::vector<std::string> {"Instance", "Pheno"});
-    phenotype.create_index(
-        "PHENOTYPE_FULL_INDEX",
-        std::vector<std::string> {"Instance", "Pheno", "FieldID", "ID"});
-    phenotype.create_index("PHENOTYPE_NO_INSTANCE_INDEX",
-                           std::vector<std::string> {"Pheno", "FieldID", "ID"});
-    phenotype.create_index(
-        "PHENOTYPE_INSTANCE_FIELD_INDEX",
-        std::vector<std::string> {"FieldID", "Instance", "ID"});
-    participants.create_index("PARTICIPANT_INDEX",
-                              std::vector<std::string> {"ID"});
+    phenotype.add_indexes(indexes);
+    // ID is the primary key already
+    indexes.add(IndexPlan::Profile::Full, "PARTICIPANT", "PARTICIPANT_INDEX",
+                {"ID"});
+    if (encode)
+    {
+        indexes.add(IndexPlan::Profile::Minimal, "PHENO_META",
+                    "PHENO_META_VALUE_INDEX", {"FieldID", "Value"});
+    }
     std::cerr << "A total of " << counts << " entries entered into database"
               << std::endl;
+    if (encode)
+    {
+        std::cerr << "With " << dictionary.size()
+                  << " distinct categorical, text and date values in "
+                     "PHENO_META"
+                  << std::endl;
+    }
     if (na_entries)
     { std::cerr << "With " << na_entries << " NA entries" << std::endl; }
 }
 
-void load_provider(sqlite3* db)
+void load_provider(sqlite3* db, const bool append, IndexPlan& indexes)
 {
     SQL gp_provider("gp_provider", db);
+    indexes.add(IndexPlan::Profile::Full, "gp_provider", "PROVIDER_INDEX",
+                {"ID"});
+    if (append && gp_provider.use_existing()) return;
     gp_provider.create_table("CREATE TABLE gp_provider(ID INT PRIMARY KEY NOT "
                              "NULL, NAME TEXT NOT NULL );");
     gp_provider.execute_sql("insert into gp_provider (ID, NAME) "
@@ -440,150 +1053,278 @@ void load_provider(sqlite3* db)
                             "VALUES(3, \"England(TPP)\")");
     gp_provider.execute_sql("insert into gp_provider (ID, NAME) "
                             "VALUES(4, \"Wales\")");
-    gp_provider.create_index("PROVIDER_INDEX", std::vector<std::string> {"ID"});
 }
-void load_gp(sqlite3* db, const std::string& gp_record, const std::string& drug)
+
+void load_date_flag(sqlite3* db, const bool append, IndexPlan& indexes)
+{
+    SQL date_flag("gp_date_flag", db);
+    indexes.add(IndexPlan::Profile::Full, "gp_date_flag", "DATE_FLAG_INDEX",
+                {"ID"});
+    if (append && date_flag.use_existing()) return;
+    date_flag.create_table("CREATE TABLE gp_date_flag(ID INT PRIMARY KEY NOT "
+                           "NULL, Date TEXT, Meaning TEXT NOT NULL);");
+    date_flag.prep_insert("INSERT INTO gp_date_flag(ID, Date, Meaning)",
+                          {SQL::Type::Integer, SQL::Type::Text,
+                           SQL::Type::Text});
+    size_t num;
+    const GpDate::Placeholder* placeholders = GpDate::placeholders(num);
+    for (size_t i = 0; i < num; ++i)
+    {
+        char date[16] = "";
+        if (placeholders[i].year != 0)
+        {
+            snprintf(date, sizeof(date), "%04d-%02u-%02u",
+                     placeholders[i].year, placeholders[i].month,
+                     placeholders[i].day);
+        }
+        date_flag.insert({static_cast<sqlite3_int64>(i + 1),
+                          misc::string_view(date, strlen(date)),
+                          misc::string_view(placeholders[i].meaning,
+                                            strlen(placeholders[i].meaning))});
+    }
+    date_flag.flush();
+}
+
+// Insert the tab delimited lines of file into table, from where an earlier
+// run stopped, and commit a chunk of rows at a time. Every line must have
+// num_column fields, blank ones included. The date in column date_idx is
+// stored as a day number, with its flag and, if it is not a date at all, its
+// text in the two parameters after the columns of the file
+void load_gp_rows(sqlite3* db, SQL& table, LineSource& file,
+                  const std::string& name, const size_t date_idx,
+                  const size_t num_column, LoadProgress& progress,
+                  MemoryBudget& budget, LoadProgress::State state)
+{
+    misc::string_view view;
+    double prev_percentage = 0;
+    std::vector<misc::string_view> token;
+    unsigned long long num_flagged = 0, num_text = 0;
+    const int date_param = static_cast<int>(date_idx + 1),
+              flag_param = static_cast<int>(num_column + 1),
+              text_param = static_cast<int>(num_column + 2);
+    if (state.offset != 0) file.skip_to(state.offset);
+    char* zErrMsg = nullptr;
+    sqlite3_exec(db, "BEGIN TRANSACTION", nullptr, nullptr, &zErrMsg);
+    while (file.next(view))
+    {
+        // only the line break goes, trimming would take the trailing blank
+        // fields with it (e.g. A\tB\t\t\t\t)
+        if (!view.empty() && view.back() == '\r') view.remove_suffix(1);
+        if (view.empty()) continue;
+        print_progress(file.tell(), file.size(), prev_percentage);
+        misc::split_fields(token, view, '\t');
+        if (token.size() != num_column)
+        {
+            throw std::runtime_error(
+                "Error: Undefined primary care record format! " + name
+                + " is expected to have exactly " + std::to_string(num_column)
+                + " columns. Line has :" + std::to_string(token.size())
+                + " column(s): " + view.to_string());
+        }
+        table.bind_statement(token, num_column);
+        // a blank cell is a missing value
+        for (size_t i = 0; i < num_column; ++i)
+        {
+            if (token[i].empty()) table.bind_null(static_cast<int>(i + 1));
+        }
+        const misc::string_view& cell = token[date_idx];
+        const GpDate date = GpDate::parse(cell);
+        if (date.flag == 0)
+        {
+            table.bind(date_param, static_cast<sqlite3_int64>(date.day));
+            table.bind_null(flag_param);
+        }
+        else
+        {
+            table.bind_null(date_param);
+            table.bind(flag_param, static_cast<sqlite3_int64>(date.flag));
+            ++num_flagged;
+        }
+        // a placeholder is known by its flag, anything else is kept as is
+        if (date.flag == 1 && !cell.empty())
+        {
+            table.bind(text_param, cell);
+            ++num_text;
+        }
+        else
+        {
+            table.bind_null(text_param);
+        }
+        table.run();
+        // every primary care row is one entry
+        ++state.rows;
+        ++state.entries;
+        state.offset = file.offset();
+        const bool squeeze = budget.pressure();
+        if (progress.due(1, state.offset) || squeeze)
+        {
+            table.flush();
+            progress.commit(name, state);
+        }
+        if (squeeze) budget.relieve(db);
+    }
+    table.flush();
+    state.offset = file.offset();
+    progress.finish(name, state);
+    sqlite3_exec(db, "END TRANSACTION", nullptr, nullptr, &zErrMsg);
+    file.close();
+    fprintf(stderr, "\rProcessing %03.2f%%\n", 100.0);
+    if (num_flagged != 0)
+    {
+        std::cerr << num_flagged << " row(s) with a placeholder or no date, "
+                  << "stored as NULL and flagged in date_flag" << std::endl;
+    }
+    if (num_text != 0)
+    {
+        std::cerr << num_text << " row(s) with a date that does not parse, "
+                  << "kept as text in date_text" << std::endl;
+    }
+}
+
+void load_gp(sqlite3* db, const std::string& gp_record, const std::string& drug,
+             const size_t num_thread, const bool append,
+             LoadProgress& progress, MemoryBudget& budget,
+             IndexPlan& indexes)
 {
     if (gp_record.empty() && drug.empty())
     {
         std::cerr << "No primary care record provided." << std::endl;
         return;
     }
-    load_provider(db);
-    if (!gp_record.empty())
+    load_provider(db, append, indexes);
+    load_date_flag(db, append, indexes);
+    const LoadProgress::State gp_state =
+        gp_record.empty() ? LoadProgress::State() : progress.start(gp_record);
+    if (!gp_record.empty() && !gp_state.done)
     {
-        std::ifstream gp_file(gp_record.c_str());
-        if (!gp_file.is_open())
+        LineSource gp_file;
+        if (!gp_file.open(gp_record, num_thread))
         {
             throw std::runtime_error(
                 "Error: Cannot open primary care record: " + gp_record
                 + ". Please check you have the correct input");
         }
-        std::string line;
+        misc::string_view view;
         // there is a header
-        auto&& file_length = get_file_length(gp_file);
         std::cerr
             << std::endl
             << "============================================================"
             << std::endl;
         std::cerr << "Header line of primary care record: " << std::endl;
-        std::getline(gp_file, line);
-        std::cerr << line << std::endl;
-        double prev_percentage = 0;
-        std::vector<std::string> token;
+        gp_file.next(view);
+        std::cerr << view.to_string() << std::endl;
         SQL gp_clinical("gp_clinical", db);
-        gp_clinical.create_table(
-            "CREATE TABLE gp_clinical("
-            "ID INT NOT NULL,"
-            "data_provider INT NOT NULL,"
-            "date_event TEXT NOT NULL, "
-            "Read2 TEXT, "
-            "Read3 TEXT, "
-            "Value1 TEXT,"
-            "Value2 TEXT,"
-            "Value3 TEXT, "
-            "FOREIGN KEY (ID) REFERENCES PARTICIPANT(ID),"
-            "FOREIGN KEY (data_provider) REFERENCES gp_provider(ID));");
-        gp_clinical.prep_statement(
+        // a primary care extract is a full release, it replaces the old one
+        // unless we are resuming the load of it. The table is dropped rather
+        // than emptied, as older runs stored dates as text
+        const bool gp_exists = append && gp_clinical.use_existing();
+        if (gp_exists && !gp_state.resumed)
+        { gp_clinical.execute_sql("DROP TABLE gp_clinical"); }
+        if (!gp_exists || !gp_state.resumed)
+        {
+            gp_clinical.create_table(
+                "CREATE TABLE gp_clinical("
+                "ID INT NOT NULL,"
+                "data_provider INT NOT NULL,"
+                "date_event INT, "
+                "Read2 TEXT, "
+                "Read3 TEXT, "
+                "Value1 TEXT,"
+                "Value2 TEXT,"
+                "Value3 TEXT, "
+                "date_flag INT, "
+                "date_text TEXT, "
+                "FOREIGN KEY (ID) REFERENCES PARTICIPANT(ID),"
+                "FOREIGN KEY (data_provider) REFERENCES gp_provider(ID),"
+                "FOREIGN KEY (date_flag) REFERENCES gp_date_flag(ID));");
+        }
+        gp_clinical.prep_insert(
             "INSERT INTO gp_clinical(ID, data_provider, date_event, Read2, "
-            "Read3, Value1, Value2, Value3) "
-            "VALUES(@ID,@PROVIDER,@DATE,@READ2,@READ3,@VALUE1,"
-            "@VALUE2,@VALUE3)");
-        char* zErrMsg = nullptr;
-        sqlite3_exec(db, "BEGIN TRANSACTION", nullptr, nullptr, &zErrMsg);
-        while (std::getline(gp_file, line))
-        {
-            // if we trim, then the last line of tab will be problematic
-            // e.g. A\tB\t\t\t\t will be problematic
-            misc::trim(line);
-            if (line.empty()) continue;
-            print_progress(gp_file.tellg(), file_length, prev_percentage);
-            // CSV input
-            // token = misc::split(line);
-            misc::split(token, line, "\t");
-            gp_clinical.run_statement(token);
-        }
-        gp_file.close();
-        sqlite3_exec(db, "END TRANSACTION", nullptr, nullptr, &zErrMsg);
-        fprintf(stderr, "\rProcessing %03.2f%%\n", 100.0);
-        gp_clinical.create_index("gp_clinical_read2",
-                                 std::vector<std::string> {"Read2", "ID"});
-        gp_clinical.create_index("gp_clinical_read3",
-                                 std::vector<std::string> {"Read3", "ID"});
-        gp_clinical.create_index(
-            "gp_clinical_reads",
-            std::vector<std::string> {"Read3", "Read2", "ID"});
-        gp_clinical.create_index("gp_clinical_date",
-                                 std::vector<std::string> {"date_event", "ID"});
-        gp_clinical.create_index(
-            "gp_clinical_reads_date",
-            std::vector<std::string> {"Read3", "Read2", "date_event", "ID"});
+            "Read3, Value1, Value2, Value3, date_flag, date_text)",
+            {SQL::Type::Integer, SQL::Type::Integer, SQL::Type::Integer,
+             SQL::Type::Text, SQL::Type::Text, SQL::Type::Text,
+             SQL::Type::Text, SQL::Type::Text, SQL::Type::Integer,
+             SQL::Type::Text});
+        load_gp_rows(db, gp_clinical, gp_file, gp_record, 2, 8, progress,
+                     budget, gp_state);
     }
-    if (!drug.empty())
+    if (!gp_record.empty())
     {
-        SQL gp_drug("gp_scripts", db);
-        std::ifstream drug_file(drug.c_str());
-        if (!drug_file.is_open())
+        indexes.add(IndexPlan::Profile::Extraction, "gp_clinical",
+                    "gp_clinical_read2", {"Read2", "ID"});
+        indexes.add(IndexPlan::Profile::Extraction, "gp_clinical",
+                    "gp_clinical_read3", {"Read3", "ID"});
+        indexes.add(IndexPlan::Profile::Full, "gp_clinical",
+                    "gp_clinical_reads", {"Read3", "Read2", "ID"});
+        indexes.add(IndexPlan::Profile::Full, "gp_clinical",
+                    "gp_clinical_date", {"date_event", "ID"});
+        indexes.add(IndexPlan::Profile::Full, "gp_clinical",
+                    "gp_clinical_reads_date",
+                    {"Read3", "Read2", "date_event", "ID"});
+    }
+    const LoadProgress::State drug_state =
+        drug.empty() ? LoadProgress::State() : progress.start(drug);
+    if (!drug.empty() && !drug_state.done)
+    {
+        LineSource drug_file;
+        if (!drug_file.open(drug, num_thread))
         {
             throw std::runtime_error(
                 "Error: Cannot open prescription record: " + drug
                 + ". Please check you have the correct input");
         }
-        std::string line;
+        misc::string_view view;
         // there is a header
-        auto&& file_length = get_file_length(drug_file);
         std::cerr
             << std::endl
             << "============================================================"
             << std::endl;
         std::cerr << "Header line of prescription record: " << std::endl;
-        std::getline(drug_file, line);
-        std::cerr << line << std::endl;
-        double prev_percentage = 0;
-        std::vector<std::string> token;
+        drug_file.next(view);
+        std::cerr << view.to_string() << std::endl;
         SQL gp_script("gp_scripts", db);
-        gp_script.create_table(
-            "CREATE TABLE gp_scripts("
-            "ID INT NOT NULL, "
-            "data_provider INT NOT NULL, "
-            "date_Issue INT NOT NULL, "
-            "Read2 Text Not Null, "
-            "BNF_Code TEXT, "
-            "DMD_Code TEXT, "
-            "Drug_Name TEXT, "
-            "Quantity TEXT, "
-            "FOREIGN KEY (ID) REFERENCES Participant(ID),"
-            "FOREIGN KEY (Data_Provider) REFERENCES gp_provider(ID));");
-        gp_script.prep_statement(
+        const bool script_exists = append && gp_script.use_existing();
+        if (script_exists && !drug_state.resumed)
+        { gp_script.execute_sql("DROP TABLE gp_scripts"); }
+        if (!script_exists || !drug_state.resumed)
+        {
+            gp_script.create_table(
+                "CREATE TABLE gp_scripts("
+                "ID INT NOT NULL, "
+                "data_provider INT NOT NULL, "
+                "date_Issue INT, "
+                "Read2 TEXT, "
+                "BNF_Code TEXT, "
+                "DMD_Code TEXT, "
+                "Drug_Name TEXT, "
+                "Quantity TEXT, "
+                "date_flag INT, "
+                "date_text TEXT, "
+                "FOREIGN KEY (ID) REFERENCES Participant(ID),"
+                "FOREIGN KEY (Data_Provider) REFERENCES gp_provider(ID),"
+                "FOREIGN KEY (date_flag) REFERENCES gp_date_flag(ID));");
+        }
+        gp_script.prep_insert(
             "INSERT INTO gp_scripts(ID, data_provider, date_Issue, Read2, "
-            "BNF_Code, DMD_Code, Drug_Name, Quantity) "
-            "VALUES(@ID,@PROVIDER,@DATE,@READ2,@READ3,@VALUE1,"
-            "@VALUE2,@VALUE3)");
-        char* zErrMsg = nullptr;
-        sqlite3_exec(db, "BEGIN TRANSACTION", nullptr, nullptr, &zErrMsg);
-        while (std::getline(drug_file, line))
-        {
-            misc::trim(line);
-            if (line.empty()) continue;
-            print_progress(drug_file.tellg(), file_length, prev_percentage);
-            // CSV input
-            misc::split(token, line, "\t");
-            gp_script.run_statement(token);
-        }
-        drug_file.close();
-        sqlite3_exec(db, "END TRANSACTION", nullptr, nullptr, &zErrMsg);
-        fprintf(stderr, "\rProcessing %03.2f%%\n", 100.0);
-        gp_script.create_index("drug_name_index",
-                               std::vector<std::string> {"Drug_Name", "ID"});
-        gp_script.create_index(
-            "drug_name_date_index",
-            std::vector<std::string> {"Drug_Name", "date_issue", "ID"});
-        gp_script.create_index(
-            "drug_name_provider_index",
-            std::vector<std::string> {"Drug_Name", "data_provider", "ID"});
-        gp_script.create_index("drug_full_index", std::vector<std::string> {
-                                                      "Drug_Name", "date_issue",
-                                                      "data_provider", "ID"});
+            "BNF_Code, DMD_Code, Drug_Name, Quantity, date_flag, date_text)",
+            {SQL::Type::Integer, SQL::Type::Integer, SQL::Type::Integer,
+             SQL::Type::Text, SQL::Type::Text, SQL::Type::Text,
+             SQL::Type::Text, SQL::Type::Text, SQL::Type::Integer,
+             SQL::Type::Text});
+        load_gp_rows(db, gp_script, drug_file, drug, 2, 8, progress, budget,
+                     drug_state);
+    }
+    if (!drug.empty())
+    {
+        indexes.add(IndexPlan::Profile::Extraction, "gp_scripts",
+                    "drug_name_index", {"Drug_Name", "ID"});
+        indexes.add(IndexPlan::Profile::Full, "gp_scripts",
+                    "drug_name_date_index", {"Drug_Name", "date_issue", "ID"});
+        indexes.add(IndexPlan::Profile::Full, "gp_scripts",
+                    "drug_name_provider_index",
+                    {"Drug_Name", "data_provider", "ID"});
+        indexes.add(IndexPlan::Profile::Full, "gp_scripts", "drug_full_index",
+                    {"Drug_Name", "date_issue", "data_provider", "ID"});
     }
 }
 
@@ -619,10 +1360,191 @@ void usage()
             "    -D | --danger   Enable optioned that speed up processing\n");
     fprintf(stderr,
             "                    May generate corrupted database file if\n");
-    fprintf(stderr, "                    server is unstable\n");
-    fprintf(stderr, "    -m | --memory   Cache memory, default 1024byte\n");
+    fprintf(stderr, "                    server is unstable. The journal is\n");
+    fprintf(stderr,
+            "                    kept in memory when a chunk fits there\n");
+    fprintf(stderr,
+            "    -M | --max-memory\n");
+    fprintf(stderr,
+            "                    Memory to stay within, in MB or with a K,\n");
+    fprintf(stderr,
+            "                    M or G suffix, default half of the memory\n");
+    fprintf(stderr,
+            "                    available. It is split between the page\n");
+    fprintf(stderr,
+            "                    cache, parsing and sorting\n");
+    fprintf(stderr,
+            "    -m | --memory   Cache size in pages, default enough for\n");
+    fprintf(stderr, "                    one chunk within --max-memory\n");
+    fprintf(stderr,
+            "    -t | --threads  Number of threads used to parse the\n");
+    fprintf(stderr, "                    phenotype file, default 1\n");
     fprintf(stderr, "    -r | --replace  Replace existing ukb database file\n");
-    fprintf(stderr, "    -h | --help     Display this help message\n\n\n");
+    fprintf(stderr,
+            "    -a | --append   Add new fields and participants to an\n");
+    fprintf(stderr,
+            "                    existing database. Showcase tables and\n");
+    fprintf(stderr,
+            "                    primary care tables given are replaced\n");
+    fprintf(stderr,
+            "    -k | --chunk    Entries to insert per transaction (one per\n");
+    fprintf(stderr,
+            "                    non-missing phenotype cell or primary care\n");
+    fprintf(stderr,
+            "                    record), or bytes of input with a K, M or\n");
+    fprintf(stderr,
+            "                    G suffix, 0 for one per file, default\n");
+    fprintf(stderr,
+            "                    1000000. How far each file got, in rows\n");
+    fprintf(stderr,
+            "                    and entries, is kept in LOAD_PROGRESS.\n");
+    fprintf(stderr,
+            "                    The phenotype of --sort and --columns\n");
+    fprintf(stderr,
+            "                    is not chunked, see --sort\n");
+    fprintf(stderr,
+            "    -R | --resume   Continue an interrupted run from its last\n");
+    fprintf(stderr,
+            "                    committed chunk, with the same input\n");
+    fprintf(stderr,
+            "    -w | --without-rowid\n");
+    fprintf(stderr,
+            "                    Store PHENOTYPE clustered by FieldID,\n");
+    fprintf(stderr,
+            "                    Instance, Array and ID, with a single\n");
+    fprintf(stderr, "                    index by participant\n");
+    fprintf(stderr,
+            "    -y | --typed    Store the values of each field in the table\n");
+    fprintf(stderr,
+            "                    of its ValueType: PHENO_INTEGER, PHENO_REAL\n");
+    fprintf(stderr,
+            "                    or PHENO_TEXT, with PHENOTYPE as a view\n");
+    fprintf(stderr, "                    over all three\n");
+    fprintf(stderr,
+            "    -i | --index    Indexes to build once all tables are loaded:\n");
+    fprintf(stderr,
+            "                    minimal, extraction, full (default) or a\n");
+    fprintf(stderr, "                    comma separated list of index names\n");
+    fprintf(stderr,
+            "    -s | --sort     Sort the phenotype entries before inserting\n");
+    fprintf(stderr,
+            "                    them, so tables and indexes are written\n");
+    fprintf(stderr,
+            "                    in order. They go in as one transaction,\n");
+    fprintf(stderr,
+            "                    --chunk does not bound it and the journal\n");
+    fprintf(stderr,
+            "                    stays on disk even with --danger\n");
+    fprintf(stderr,
+            "    -T | --temp     Directory for temporary files of --sort,\n");
+    fprintf(stderr, "                    default $TMPDIR or /tmp\n");
+    fprintf(stderr,
+            "    -C | --columns  Also write the phenotype as one compressed\n");
+    fprintf(stderr,
+            "                    column per field, instance and array to\n");
+    fprintf(stderr,
+            "                    <Output>.columns, listed in <Output>.catalog\n");
+    fprintf(stderr,
+            "                    The entries are sorted as with --sort\n");
+    fprintf(stderr,
+            "    -f | --fields   Comma separated field IDs to load, other\n");
+    fprintf(stderr,
+            "                    phenotype columns are skipped.\n");
+    fprintf(stderr,
+            "                    Fields picked by --fields, --categories\n");
+    fprintf(stderr,
+            "                    and --field-file are all loaded. Default\n");
+    fprintf(stderr, "                    is every field\n");
+    fprintf(stderr,
+            "    -x | --categories\n");
+    fprintf(stderr,
+            "                    Comma separated categories of the data\n");
+    fprintf(stderr,
+            "                    showcase whose fields are loaded\n");
+    fprintf(stderr,
+            "    -F | --field-file\n");
+    fprintf(stderr,
+            "                    File of field IDs to load, separated by\n");
+    fprintf(stderr,
+            "                    white space or commas\n");
+    fprintf(stderr,
+            "    -e | --encode   Store categorical, text and date values\n");
+    fprintf(stderr,
+            "                    once in PHENO_META and refer to them by\n");
+    fprintf(stderr, "                    ID in PHENOTYPE\n");
+    fprintf(stderr, "    -h | --help     Display this help message\n\n");
+    fprintf(stderr,
+            " Usage: ukb_process recompress [options] <Input> <Output>\n");
+    fprintf(stderr,
+            "    Rewrite a phenotype or primary care file as BGZF or\n");
+    fprintf(stderr,
+            "    seekable zstd, which --threads threads can decompress\n");
+    fprintf(stderr, "    in parallel\n");
+    fprintf(stderr,
+            "    -z | --zstd     Write seekable zstd instead of BGZF\n");
+    fprintf(stderr, "    -l | --level    Compression level\n");
+    fprintf(stderr,
+            "    -t | --threads  Number of compression threads, default 1\n\n\n");
+}
+
+int recompress_main(int argc, char* argv[])
+{
+    static const char* optString = "l:t:zh?";
+    static const struct option longOpts[] = {
+        {"level", required_argument, nullptr, 'l'},
+        {"threads", required_argument, nullptr, 't'},
+        {"zstd", no_argument, nullptr, 'z'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}};
+    int longIndex = 0;
+    int opt = 0;
+    std::string level, threads = "1";
+    Decompressor::Format format = Decompressor::Format::Bgzf;
+    while ((opt = getopt_long(argc, argv, optString, longOpts, &longIndex))
+           != -1)
+    {
+        switch (opt)
+        {
+        case 'l': level = optarg; break;
+        case 't': threads = optarg; break;
+        case 'z': format = Decompressor::Format::SeekableZstd; break;
+        case 'h':
+        case '?': usage(); return 0;
+        default:
+            throw "Undefined operator, please use --help for more "
+                  "information!";
+        }
+    }
+    if (argc - optind != 2)
+    {
+        std::cerr << "Error: recompress takes an input and an output file"
+                  << std::endl;
+        return -1;
+    }
+    int num_thread = 0, compression_level = 0;
+    try
+    {
+        num_thread = misc::convert<int>(threads);
+        // same defaults as gzip and zstd
+        compression_level =
+            level.empty()
+                ? (format == Decompressor::Format::Bgzf ? 6 : 3)
+                : misc::convert<int>(level);
+    }
+    catch (const std::runtime_error&)
+    {
+        std::cerr << "Error: Invalid number of threads or level" << std::endl;
+        return -1;
+    }
+    if (num_thread < 1)
+    {
+        std::cerr << "Error: Number of threads must be a positive integer: "
+                  << threads << std::endl;
+        return -1;
+    }
+    recompress(argv[optind], argv[optind + 1], format, compression_level,
+               static_cast<size_t>(num_thread));
+    return 0;
 }
 int main(int argc, char* argv[])
 {
@@ -631,16 +1553,33 @@ int main(int argc, char* argv[])
         usage();
         return -1;
     }
-    static const char* optString = "d:c:p:o:m:g:u:rDh?";
+    if (std::string(argv[1]) == "recompress")
+    { return recompress_main(argc - 1, argv + 1); }
+    static const char* optString = "d:c:p:o:m:M:g:u:t:T:i:k:f:x:F:raRewysCDh?";
     static const struct option longOpts[] = {
         {"data", required_argument, nullptr, 'd'},
         {"code", required_argument, nullptr, 'c'},
         {"pheno", required_argument, nullptr, 'p'},
         {"out", required_argument, nullptr, 'o'},
         {"memory", required_argument, nullptr, 'm'},
+        {"max-memory", required_argument, nullptr, 'M'},
         {"gp", required_argument, nullptr, 'g'},
         {"drug", required_argument, nullptr, 'u'},
+        {"threads", required_argument, nullptr, 't'},
         {"replace", no_argument, nullptr, 'r'},
+        {"append", no_argument, nullptr, 'a'},
+        {"resume", no_argument, nullptr, 'R'},
+        {"chunk", required_argument, nullptr, 'k'},
+        {"encode", no_argument, nullptr, 'e'},
+        {"without-rowid", no_argument, nullptr, 'w'},
+        {"typed", no_argument, nullptr, 'y'},
+        {"sort", no_argument, nullptr, 's'},
+        {"temp", required_argument, nullptr, 'T'},
+        {"index", required_argument, nullptr, 'i'},
+        {"columns", no_argument, nullptr, 'C'},
+        {"fields", required_argument, nullptr, 'f'},
+        {"categories", required_argument, nullptr, 'x'},
+        {"field-file", required_argument, nullptr, 'F'},
         {"danger", no_argument, nullptr, 'D'},
         {"help", no_argument, nullptr, 'h'},
         {nullptr, 0, nullptr, 0}};
@@ -648,21 +1587,42 @@ int main(int argc, char* argv[])
     int opt = 0;
     opt = getopt_long(argc, argv, optString, longOpts, &longIndex);
     std::string data_showcase, code_showcase, pheno_name, out_name,
-        memory = "1024", gp_name, drug_name;
-    bool replace = false, danger = false;
+        memory, gp_name, drug_name, threads = "1",
+        index_profile = "full", chunk = "1000000", max_memory;
+    const char* tmpdir = getenv("TMPDIR");
+    std::string temp_dir = (tmpdir != nullptr && *tmpdir) ? tmpdir : "/tmp";
+    bool replace = false, append = false, resume = false, danger = false,
+         encode = false, clustered = false, typed = false, presort = false,
+         columnar = false;
+    std::vector<std::string> field_lists, category_lists, field_files;
     while (opt != -1)
     {
         switch (opt)
         {
         case 'd': data_showcase = optarg; break;
         case 'm': memory = optarg; break;
+        case 'M': max_memory = optarg; break;
         case 'D': danger = true; break;
         case 'c': code_showcase = optarg; break;
         case 'p': pheno_name = optarg; break;
         case 'o': out_name = optarg; break;
         case 'r': replace = true; break;
+        case 'a': append = true; break;
+        case 'R': resume = true; break;
+        case 'k': chunk = optarg; break;
+        case 'e': encode = true; break;
+        case 'w': clustered = true; break;
+        case 'y': typed = true; break;
+        case 's': presort = true; break;
+        case 'T': temp_dir = optarg; break;
+        case 'i': index_profile = optarg; break;
+        case 'C': columnar = true; break;
+        case 'f': field_lists.push_back(optarg); break;
+        case 'x': category_lists.push_back(optarg); break;
+        case 'F': field_files.push_back(optarg); break;
         case 'g': gp_name = optarg; break;
         case 'u': drug_name = optarg; break;
+        case 't': threads = optarg; break;
         case 'h':
         case '?': usage(); return 0;
         default:
@@ -694,6 +1654,69 @@ int main(int argc, char* argv[])
         error = true;
         std::cerr << "Error: You must provide output prefix!" << std::endl;
     }
+    int num_thread = 0;
+    try
+    {
+        num_thread = misc::convert<int>(threads);
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+    if (num_thread < 1)
+    {
+        error = true;
+        std::cerr << "Error: Number of threads must be a positive integer: "
+                  << threads << std::endl;
+    }
+    if ((append || resume) && replace)
+    {
+        error = true;
+        std::cerr << "Error: --append and --resume cannot be used with "
+                     "--replace"
+                  << std::endl;
+    }
+    if ((append || resume) && columnar)
+    {
+        error = true;
+        std::cerr << "Error: --columns cannot be used with --append or "
+                     "--resume, the column store is written in one go"
+                  << std::endl;
+    }
+    unsigned long long memory_limit = 0;
+    if (!max_memory.empty() && !MemoryBudget::parse(max_memory, memory_limit))
+    {
+        error = true;
+        std::cerr << "Error: Memory limit must be a size in MB, or with a K, "
+                     "M or G suffix: "
+                  << max_memory << std::endl;
+    }
+    unsigned long long chunk_entries = 0, chunk_bytes = 0;
+    if (!LoadProgress::parse_chunk(chunk, chunk_entries, chunk_bytes))
+    {
+        error = true;
+        std::cerr << "Error: Chunk size must be a number of entries or of "
+                     "bytes "
+                     "(e.g. 256M): "
+                  << chunk << std::endl;
+    }
+    FieldSelection selection;
+    for (auto&& list : field_lists)
+    {
+        if (selection.add_fields(list)) continue;
+        error = true;
+        std::cerr << "Error: --fields must be a comma separated list of "
+                     "field IDs: "
+                  << list << std::endl;
+    }
+    for (auto&& list : category_lists)
+    {
+        if (selection.add_categories(list)) continue;
+        error = true;
+        std::cerr << "Error: --categories must be a comma separated list of "
+                     "category IDs: "
+                  << list << std::endl;
+    }
+    for (auto&& file : field_files) selection.add_field_file(file);
     if (error)
     {
         std::cerr << "Please check you have all the required input!"
@@ -702,13 +1725,22 @@ int main(int argc, char* argv[])
     }
     std::string db_name = out_name + ".db";
     sqlite3* db;
-    if (misc::file_exists(db_name))
+    if ((append || resume) && !misc::file_exists(db_name))
+    {
+        std::cerr << "Error: Database file to "
+                  << (resume ? "resume" : "append to")
+                  << " does not exist: " << db_name << std::endl;
+        return -1;
+    }
+    if (!append && !resume && misc::file_exists(db_name))
     {
         // emit warning and delete file
         if (!replace)
         {
             std::cerr << "Error: Database file exists: " + db_name << std::endl;
-            std::cerr << "       Use --replace to replace it" << std::endl;
+            std::cerr << "       Use --replace to replace it, or --append to "
+                         "add to it"
+                      << std::endl;
             return -1;
         }
         std::remove(db_name.c_str());
@@ -724,15 +1756,62 @@ int main(int argc, char* argv[])
         std::cerr << "Opened database: " << db_name << std::endl;
     }
 
-    std::unordered_set<std::string> included_fields;
+    IdRegistry included_fields;
     std::vector<std::string> pheno_names = misc::split(pheno_name, ",");
-    char* zErrMsg = nullptr;
-    sqlite3_exec(db, std::string("PRAGMA cache_size = " + memory).c_str(),
-                 nullptr, nullptr, &zErrMsg);
-    load_phenotype(db, included_fields, pheno_names, danger);
-    load_data(db, included_fields, data_showcase);
-    load_code(db, code_showcase);
-    load_gp(db, gp_name, drug_name);
+    ExistingDatabase existing;
+    // resuming reuses the tables of the interrupted run the same way
+    append |= resume;
+    if (append)
+    {
+        existing = read_existing(db, db_name, resume);
+        // new entries have to be stored the way the old ones are
+        if (existing.fields.size() != 0
+            && (encode != existing.encoded || clustered != existing.clustered
+                || typed != existing.typed))
+        {
+            std::cerr << "Warning: Layout options are taken from the existing "
+                         "database, --encode, --without-rowid and --typed are "
+                         "ignored"
+                      << std::endl;
+        }
+        if (existing.fields.size() != 0)
+        {
+            encode = existing.encoded;
+            clustered = existing.clustered;
+            typed = existing.typed;
+        }
+    }
+    LoadProgress progress(db, chunk_entries, chunk_bytes, resume);
+    MemoryBudget budget(memory_limit);
+    budget.configure(db, progress.chunk_memory(), memory, danger,
+                     presort || columnar);
+    // the ValueType of each field decides how its values are stored
+    FieldCatalog catalog;
+    IndexPlan indexes(index_profile);
+    load_data(db, data_showcase, existing.fields, append, catalog, indexes);
+    load_code(db, code_showcase, append, indexes);
+    progress.report("showcase");
+    selection.resolve(db);
+    if (selection.active())
+    {
+        std::cerr << selection.size() << " field(s) selected" << std::endl;
+    }
+    std::unique_ptr<ColumnStore> columns;
+    if (columnar) columns.reset(new ColumnStore(out_name, catalog));
+    load_phenotype(db, included_fields, pheno_names, catalog, selection,
+                   encode, static_cast<size_t>(num_thread), clustered, typed,
+                   presort, temp_dir, existing, progress, budget,
+                   columns.get(), indexes);
+    for (auto&& field : existing.fields.sorted()) included_fields.insert(field);
+    include_fields(db, included_fields);
+    if (columns) columns->write_catalog(db);
+    progress.report("phenotype");
+    load_gp(db, gp_name, drug_name, static_cast<size_t>(num_thread), append,
+            progress, budget, indexes);
+    progress.report("primary care");
+    budget.prepare_indexes(db, static_cast<size_t>(num_thread));
+    indexes.build(db, static_cast<size_t>(num_thread));
+    progress.report("indexes");
     sqlite3_close(db);
     return 0;
 }
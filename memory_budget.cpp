@@ -0,0 +1,161 @@
+#include "memory_budget.h"
+#include "misc.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+namespace
+{
+// bytes a phenotype batch holds for each byte of its input: a copy of the
+// lines when they are streamed, and the views of the cells parsed from them
+const unsigned long long batch_expansion = 8;
+const unsigned long long min_batch_byte = 256 * 1024;
+const unsigned long long max_batch_byte = 16 * 1024 * 1024;
+const unsigned long long min_run_byte = 1024 * 1024;
+// smallest page cache, the SQLite default
+const unsigned long long min_cache_kib = 2000;
+
+void set_cache(sqlite3* db, unsigned long long kib)
+{
+    // negative sizes are in KiB rather than pages
+    char* zErrMsg = nullptr;
+    sqlite3_exec(db,
+                 ("PRAGMA cache_size = -" + std::to_string(kib)).c_str(),
+                 nullptr, nullptr, &zErrMsg);
+}
+}
+
+const std::chrono::milliseconds MemoryBudget::check_interval(100);
+
+MemoryBudget::MemoryBudget(unsigned long long limit)
+    : m_limit(limit != 0 ? limit : misc::total_ram_available())
+{
+    fprintf(stderr,
+            "Memory budget: %.0f MB (SQLite %.0f MB, phenotype batches %.0f "
+            "MB, sorting %.0f MB)\n",
+            m_limit / 1048576.0, sqlite() / 1048576.0, batches() / 1048576.0,
+            sort() / 1048576.0);
+}
+
+bool MemoryBudget::parse(const std::string& text, unsigned long long& limit)
+{
+    unsigned long long number, unit;
+    if (!misc::parse_size(text, number, unit)) return false;
+    limit = number * (unit == 1 ? 1048576 : unit);
+    return limit != 0;
+}
+
+void MemoryBudget::configure(sqlite3* db, unsigned long long chunk_memory,
+                             const std::string& cache_pages, bool danger,
+                             bool presort)
+{
+    char* zErrMsg = nullptr;
+    // the sorted entries are inserted in a single transaction, which grows
+    // with every page it changes however small the chunks are
+    if (presort) chunk_memory = 0;
+    // SQLite recycles its cache pages rather than grow past its share
+    sqlite3_soft_heap_limit64(static_cast<sqlite3_int64>(sqlite()));
+    // the journal keeps the original of every page a transaction changes,
+    // it only goes to memory if a whole chunk of them fits in half the share
+    const bool memory_journal =
+        danger && chunk_memory != 0 && chunk_memory <= sqlite() / 2;
+    if (cache_pages.empty())
+    {
+        // keep the pages a chunk dirties in the cache until it commits,
+        // rather than spilling them to the database half way through
+        const unsigned long long room =
+            memory_journal ? sqlite() - chunk_memory : sqlite();
+        const unsigned long long bytes =
+            (chunk_memory == 0) ? room : std::min(chunk_memory, room);
+        m_cache_kib = std::max(bytes / 1024, min_cache_kib);
+        set_cache(db, m_cache_kib);
+    }
+    else
+    {
+        sqlite3_exec(db, ("PRAGMA cache_size = " + cache_pages).c_str(),
+                     nullptr, nullptr, &zErrMsg);
+    }
+    if (!danger) return;
+    sqlite3_exec(db, "PRAGMA synchronous = OFF", nullptr, nullptr, &zErrMsg);
+    if (memory_journal)
+    {
+        sqlite3_exec(db, "PRAGMA journal_mode = MEMORY", nullptr, nullptr,
+                     &zErrMsg);
+    }
+    else if (presort)
+    {
+        std::cerr << "Warning: Sorted entries are inserted in one "
+                     "transaction, which --chunk does not bound, keeping the "
+                     "journal on disk"
+                  << std::endl;
+    }
+    else
+    {
+        std::cerr << "Warning: Transactions do not fit a quarter of the "
+                     "memory budget, keeping the journal on disk. Use --chunk "
+                     "to bound them"
+                  << std::endl;
+    }
+}
+
+void MemoryBudget::prepare_indexes(sqlite3* db, size_t num_thread)
+{
+    if (m_cache_kib == 0) return;
+    // each sorter thread of CREATE INDEX sorts up to a cache worth of entries
+    // in memory before it writes them out
+    const unsigned long long share =
+        sqlite() / (std::max<size_t>(num_thread, 1) + 1);
+    m_cache_kib = std::max(share / 1024, min_cache_kib);
+    set_cache(db, m_cache_kib);
+}
+
+unsigned long long MemoryBudget::batch_byte(size_t num_batch) const
+{
+    const unsigned long long size =
+        batches() / (std::max<size_t>(num_batch, 1) * batch_expansion);
+    return std::min(std::max(size, min_batch_byte), max_batch_byte);
+}
+
+size_t MemoryBudget::run_byte(size_t num_thread) const
+{
+    // one run is gathered while each worker may hold a queued run, and one
+    // being sorted along with its serialized copy
+    const unsigned long long size =
+        sort() / (3 * std::max<size_t>(num_thread, 1) + 1);
+    return static_cast<size_t>(std::max(size, min_run_byte));
+}
+
+bool MemoryBudget::pressure()
+{
+    const auto now = std::chrono::steady_clock::now();
+    if (now - m_last_check < check_interval) return false;
+    m_last_check = now;
+    const size_t resident = misc::current_ram_usage();
+    // without a reading there is nothing to relieve
+    return resident != 0 && resident >= m_limit / 10 * 9;
+}
+
+void MemoryBudget::relieve(sqlite3* db)
+{
+    // a cache size given by the user is left alone
+    if (m_cache_kib != 0)
+    {
+        m_cache_kib = std::max(m_cache_kib / 2, min_cache_kib);
+        set_cache(db, m_cache_kib);
+    }
+    sqlite3_db_release_memory(db);
+#ifdef __GLIBC__
+    // hand freed memory back to the system, or the resident size stays put
+    malloc_trim(0);
+#endif
+    if (m_num_relief++ == 0)
+    {
+        fprintf(stderr,
+                "\nWarning: Memory use is close to the limit of %.0f MB, "
+                "committing early and shrinking the page cache\n",
+                m_limit / 1048576.0);
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef PROCESS_MEMORY_BUDGET_H
+#define PROCESS_MEMORY_BUDGET_H
+
+#include <chrono>
+#include <cstddef>
+#include <sqlite3.h>
+#include <string>
+
+// Split the --max-memory limit between the parts of a load that hold on to
+// memory: SQLite (page cache and an in memory journal), the phenotype batches
+// on their way from the reader to the writer and the runs of the external
+// sorter. The last tenth is left to the participant and value sets, which
+// grow with the data. The resident size is checked against the limit as the
+// load goes, so the loaders can give memory back before they go over
+class MemoryBudget
+{
+public:
+    // limit in bytes, 0 for misc::total_ram_available()
+    explicit MemoryBudget(unsigned long long limit);
+    // Parse a limit in MB, or in bytes with a K, M or G suffix. Return false
+    // if text is neither
+    static bool parse(const std::string& text, unsigned long long& limit);
+    unsigned long long limit() const { return m_limit; }
+    unsigned long long sqlite() const { return m_limit / 2; }
+    unsigned long long batches() const { return m_limit / 5; }
+    unsigned long long sort() const { return m_limit / 5; }
+    // Size the page cache of db and place its journal, for transactions of
+    // chunk_memory bytes (0 if unbounded). cache_pages overrides the cache.
+    // A presorted phenotype goes in as one transaction whatever the chunk,
+    // so its journal stays on disk
+    void configure(sqlite3* db, unsigned long long chunk_memory,
+                   const std::string& cache_pages, bool danger, bool presort);
+    // Before indexes are built by num_thread sorter threads, leave room in
+    // the SQLite share for the sorter next to the cache
+    void prepare_indexes(sqlite3* db, size_t num_thread);
+    // largest phenotype batch in bytes of input, with num_batch in flight
+    unsigned long long batch_byte(size_t num_batch) const;
+    // run size of an external sorter with num_thread workers
+    size_t run_byte(size_t num_thread) const;
+    // True when the resident size got close to the limit. The size is read at
+    // most every check_interval, and only a fresh reading returns true. A
+    // size that cannot be read never does
+    bool pressure();
+    // Have SQLite give back the memory it can, and shrink its cache
+    void relieve(sqlite3* db);
+
+private:
+    static const std::chrono::milliseconds check_interval;
+    unsigned long long m_limit;
+    // current page cache of the database in KiB, 0 if set by the user
+    unsigned long long m_cache_kib = 0;
+    unsigned long long m_num_relief = 0;
+    std::chrono::steady_clock::time_point m_last_check;
+};
+
+#endif // PROCESS_MEMORY_BUDGET_H
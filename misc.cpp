@@ -16,9 +16,172 @@
 
 
 #include "misc.hpp"
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define MISC_X86_KERNEL
+#endif
 
 namespace misc
 {
+namespace
+{
+// Fields are cut at each delimiter and empty fields are skipped, same as
+// split(). The vector kernels compare 16 or 32 bytes against the delimiter at
+// once and walk the set bits of the resulting mask, so the cost per byte no
+// longer depends on how short the fields are
+inline void add_field(std::vector<string_view>& result, const char* data,
+                      size_t& prev, size_t pos)
+{
+    if (pos > prev) result.emplace_back(data + prev, pos - prev);
+    prev = pos + 1;
+}
+
+inline void split_tail(std::vector<string_view>& result, const char* data,
+                       size_t size, char delim, size_t max_field, size_t i,
+                       size_t prev)
+{
+    for (; i < size && result.size() < max_field; ++i)
+    {
+        if (data[i] == delim) add_field(result, data, prev, i);
+    }
+    if (prev < size && result.size() < max_field)
+    { result.emplace_back(data + prev, size - prev); }
+}
+
+void split_scalar(std::vector<string_view>& result, const char* data,
+                  size_t size, char delim, size_t max_field)
+{
+    split_tail(result, data, size, delim, max_field, 0, 0);
+}
+
+#ifdef MISC_X86_KERNEL
+__attribute__((target("sse2"))) void
+split_sse2(std::vector<string_view>& result, const char* data, size_t size,
+           char delim, size_t max_field)
+{
+    const __m128i needle = _mm_set1_epi8(delim);
+    size_t prev = 0, i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        const __m128i block =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        unsigned int mask = static_cast<unsigned int>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle)));
+        while (mask)
+        {
+            add_field(result, data, prev,
+                      i + static_cast<size_t>(__builtin_ctz(mask)));
+            mask &= mask - 1;
+        }
+        // the fields wanted are complete, the rest is not looked at
+        if (result.size() >= max_field) return;
+    }
+    split_tail(result, data, size, delim, max_field, i, prev);
+}
+
+__attribute__((target("avx2"))) void
+split_avx2(std::vector<string_view>& result, const char* data, size_t size,
+           char delim, size_t max_field)
+{
+    const __m256i needle = _mm256_set1_epi8(delim);
+    size_t prev = 0, i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        const __m256i block =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        unsigned int mask = static_cast<unsigned int>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle)));
+        while (mask)
+        {
+            add_field(result, data, prev,
+                      i + static_cast<size_t>(__builtin_ctz(mask)));
+            mask &= mask - 1;
+        }
+        // the fields wanted are complete, the rest is not looked at
+        if (result.size() >= max_field) return;
+    }
+    split_tail(result, data, size, delim, max_field, i, prev);
+}
+#endif
+
+typedef void (*split_kernel)(std::vector<string_view>&, const char*, size_t,
+                             char, size_t);
+struct split_dispatch
+{
+    split_kernel kernel;
+    const char* name;
+};
+
+split_dispatch select_split_kernel()
+{
+#ifdef MISC_X86_KERNEL
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return {split_avx2, "AVX2"};
+    if (__builtin_cpu_supports("sse2")) return {split_sse2, "SSE2"};
+#endif
+    return {split_scalar, "scalar"};
+}
+
+const split_dispatch& split_impl()
+{
+    static const split_dispatch impl = select_split_kernel();
+    return impl;
+}
+}
+
+void split(std::vector<string_view>& result, const string_view& seq,
+           char delim, size_t max_field)
+{
+    result.clear();
+    if (seq.empty() || max_field == 0) return;
+    split_impl().kernel(result, seq.data(), seq.size(), delim, max_field);
+    // a block can close more fields than wanted
+    if (result.size() > max_field) result.resize(max_field);
+}
+
+const char* split_kernel_name() { return split_impl().name; }
+
+ParseStatus read_double_slow(const string_view& str, double& value)
+{
+    // strtod rounds correctly but reads the decimal point of the locale, so
+    // the number is handed over as digits and an exponent, which read the
+    // same in every locale. read_double has checked the syntax already
+    std::string number;
+    number.reserve(str.size() + 8);
+    long long exponent = 0;
+    bool fraction = false;
+    const char* p = str.begin();
+    const char* end = str.end();
+    if (*p == '-' || *p == '+') number.push_back(*p++);
+    for (; p != end && *p != 'e' && *p != 'E'; ++p)
+    {
+        if (*p == '.')
+        {
+            fraction = true;
+            continue;
+        }
+        number.push_back(*p);
+        exponent -= fraction;
+    }
+    if (p != end)
+    {
+        ++p;
+        const bool neg = (*p == '-');
+        if (*p == '-' || *p == '+') ++p;
+        long long e = 0;
+        for (; p != end; ++p)
+        {
+            if (e < 100000) e = e * 10 + (*p - '0');
+        }
+        exponent += neg ? -e : e;
+    }
+    number.push_back('e');
+    number += std::to_string(exponent);
+    value = strtod(number.c_str(), nullptr);
+    // values too small for a double round to zero, like any other
+    return std::isinf(value) ? ParseStatus::OutOfRange : ParseStatus::Ok;
+}
+
 double dnorm(double x, double mu, double sigma, bool log)
 {
 #ifdef IEEE_754
@@ -21,6 +21,8 @@
 #define _USE_MATH_DEFINES
 #include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <limits>
@@ -28,6 +30,7 @@
 #include <random>
 #include <sstream>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 #if defined __APPLE__
@@ -132,20 +135,23 @@ inline int parseLine(char* line)
 
 inline int getValue()
 { // Note: this value is in KB!
+    // Resident memory, less the pages of mapped files which the kernel can
+    // drop whenever it needs them
     FILE* file = fopen("/proc/self/status", "r");
-    int result = -1;
+    if (file == NULL) return -1;
+    int result = -1, file_backed = 0;
     char line[128];
 
     while (fgets(line, 128, file) != NULL)
     {
-        if (strncmp(line, "VmSize:", 7) == 0)
+        if (strncmp(line, "VmRSS:", 6) == 0) { result = parseLine(line); }
+        else if (strncmp(line, "RssFile:", 8) == 0)
         {
-            result = parseLine(line);
-            break;
+            file_backed = parseLine(line);
         }
     }
     fclose(file);
-    return result;
+    return result < 0 ? result : result - file_backed;
 }
 
 inline bool file_exists(const std::string& name)
@@ -153,7 +159,7 @@ inline bool file_exists(const std::string& name)
     std::ifstream f(name.c_str());
     return f.good();
 }
-// this works on MAC and Linux
+// this works on MAC and Linux, 0 if the resident size cannot be read
 inline size_t current_ram_usage()
 {
 #if defined __APPLE__
@@ -176,7 +182,9 @@ inline size_t current_ram_usage()
     SIZE_T physMemUsedByMe = memCounter.WorkingSetSize;
     return physMemUsedByMe;
 #else
-    return getValue() * 1024;
+    // in size_t, an int overflows once the process passes 2GB
+    const int kb = getValue();
+    return kb < 0 ? 0 : static_cast<size_t>(kb) * 1024;
 #endif
 }
 
@@ -289,63 +297,135 @@ private:
 };
 
 
+// Non-owning reference to a run of characters, e.g. a line of a mapped file
+// or one field of that line. A cut down std::string_view, as we are on C++11
+class string_view
+{
+public:
+    string_view() {}
+    string_view(const char* data, size_t size) : m_data(data), m_size(size) {}
+    string_view(const std::string& str) : m_data(str.data()), m_size(str.size())
+    {
+    }
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    const char* begin() const { return m_data; }
+    const char* end() const { return m_data + m_size; }
+    const char& operator[](size_t i) const { return m_data[i]; }
+    char front() const { return m_data[0]; }
+    char back() const { return m_data[m_size - 1]; }
+    void remove_prefix(size_t n)
+    {
+        m_data += n;
+        m_size -= n;
+    }
+    void remove_suffix(size_t n) { m_size -= n; }
+    string_view substr(size_t pos, size_t len) const
+    {
+        return string_view(m_data + pos, std::min(len, m_size - pos));
+    }
+    std::string to_string() const { return std::string(m_data, m_size); }
+    bool operator==(const string_view& other) const
+    {
+        return m_size == other.m_size
+               && (m_size == 0 || memcmp(m_data, other.m_data, m_size) == 0);
+    }
+    bool operator!=(const string_view& other) const { return !(*this == other); }
+    bool operator==(const char* str) const
+    {
+        return *this == string_view(str, strlen(str));
+    }
+    bool operator!=(const char* str) const { return !(*this == str); }
+
+private:
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+};
+
 // Functions from R
 double dnorm(double x, double mu = 0.0, double sigma = 1.0, bool log = false);
 double qnorm(double p, double mu = 0.0, double sigma = 1.0,
              bool lower_tail = true, bool log_p = false);
 
-inline std::vector<std::string> csv_split(const std::string& seq)
+// Split one CSV record (RFC 4180) into views of its unquoted fields in a
+// single pass. Quoted fields may hold commas, line breaks and "" for a quote.
+// Fields without an escaped quote point into record, the others are unescaped
+// into buffer, which is sized up front so those views stay valid until the
+// next call. Empty fields are kept as empty views
+inline void csv_split(std::vector<string_view>& result,
+                      const string_view& record, std::vector<char>& buffer)
 {
-    std::size_t prev = 0, pos;
-    std::vector<std::string> result;
-    // we first need to find columns surrounded by "
-    bool quoted = false;
-    std::string temp;
-    long num_quote;
-    while ((pos = seq.find_first_of(",", prev)) != std::string::npos)
+    result.clear();
+    buffer.clear();
+    buffer.reserve(record.size());
+    const char* data = record.data();
+    const size_t size = record.size();
+    size_t i = 0;
+    while (true)
     {
-        if (pos > prev)
+        if (i < size && data[i] == '\"')
         {
-            if (quoted)
+            size_t segment = ++i;
+            const size_t buffer_begin = buffer.size();
+            bool escaped = false;
+            while (true)
             {
-                // previous is quoted
-                temp = temp.append("," + seq.substr(prev, pos - prev));
-                num_quote = std::count(temp.begin(), temp.end(), '\"');
-                if (temp.back() == '\"' && num_quote % 2 == 0)
+                const char* quote = static_cast<const char*>(
+                    memchr(data + i, '\"', size - i));
+                if (quote == nullptr)
+                {
+                    throw std::runtime_error(
+                        "Error: Unterminated quote in CSV record: "
+                        + record.to_string());
+                }
+                const size_t pos = static_cast<size_t>(quote - data);
+                if (pos + 1 < size && data[pos + 1] == '\"')
+                {
+                    // keep one of the two quotes
+                    buffer.insert(buffer.end(), data + segment, data + pos + 1);
+                    escaped = true;
+                    i = segment = pos + 2;
+                    continue;
+                }
+                if (escaped)
+                {
+                    buffer.insert(buffer.end(), data + segment, data + pos);
+                    result.emplace_back(buffer.data() + buffer_begin,
+                                        buffer.size() - buffer_begin);
+                }
+                else
                 {
-                    quoted = false;
-                    result.emplace_back(temp);
+                    result.emplace_back(data + segment, pos - segment);
                 }
+                i = pos + 1;
+                break;
             }
-            else
+            if (i < size && data[i] != ',')
             {
-                temp = seq.substr(prev, pos - prev);
-                num_quote = std::count(temp.begin(), temp.end(), '\"');
-                if (temp.front() == '\"' && temp.back() != '\"'
-                    && num_quote % 2 != 0)
-                    quoted = true;
-                else
-                    result.emplace_back(temp);
+                throw std::runtime_error(
+                    "Error: Unexpected character after closing quote in CSV "
+                    "record: "
+                    + record.to_string());
             }
         }
-        else if (pos == prev)
+        else
         {
-            // this is null
-            result.emplace_back("NULL");
+            const char* comma =
+                static_cast<const char*>(memchr(data + i, ',', size - i));
+            const size_t end =
+                (comma == nullptr) ? size : static_cast<size_t>(comma - data);
+            result.emplace_back(data + i, end - i);
+            i = end;
         }
-        prev = pos + 1;
-    }
-    if (prev < seq.length())
-    {
-        if (quoted)
+        if (i >= size) break;
+        // data[i] is the comma, a trailing comma ends with an empty field
+        if (++i == size)
         {
-            temp.append("," + seq.substr(prev, std::string::npos));
-            result.emplace_back(temp);
+            result.emplace_back(data + size, 0);
+            break;
         }
-        else
-            result.emplace_back(seq.substr(prev, std::string::npos));
     }
-    return result;
 }
 
 // codes from stackoverflow
@@ -377,8 +457,271 @@ inline void split(std::vector<std::string>& result, const std::string& seq,
     if (prev < seq.length())
     { result.emplace_back(seq.substr(prev, std::string::npos)); }
 }
+// Split on a single delimiter with the SSE2/AVX2 kernel in misc.cpp, picked
+// at run time from what the CPU supports. Scanning stops once max_field fields
+// are found, anything after them is left unread
+void split(std::vector<string_view>& result, const string_view& seq,
+           char delim,
+           size_t max_field = std::numeric_limits<size_t>::max());
+// name of the kernel used by split(), for logging
+const char* split_kernel_name();
+
+// Split seq at every delim and keep the empty fields, so each field is found
+// by its position even when a field before it is blank. n delimiters always
+// give n + 1 fields
+inline void split_fields(std::vector<string_view>& result,
+                         const string_view& seq, char delim)
+{
+    result.clear();
+    const char* prev = seq.begin();
+    const char* end = seq.end();
+    const char* pos;
+    while ((pos = static_cast<const char*>(
+                memchr(prev, delim, static_cast<size_t>(end - prev))))
+           != nullptr)
+    {
+        result.emplace_back(prev, static_cast<size_t>(pos - prev));
+        prev = pos + 1;
+    }
+    result.emplace_back(prev, static_cast<size_t>(end - prev));
+}
+
+// Split seq into views of its fields, nothing is copied. Same as split(),
+// empty fields are skipped. result is reused across calls, so once it has
+// grown to the widest line no further allocation is needed
+inline void split(std::vector<string_view>& result, const string_view& seq,
+                  const char* separators = "\t ")
+{
+    if (separators[0] != '\0' && separators[1] == '\0')
+    {
+        split(result, seq, separators[0]);
+        return;
+    }
+    result.clear();
+    if (seq.empty()) return;
+    const char* prev = seq.begin();
+    const char* end = seq.end();
+    for (const char* pos = prev; pos != end; ++pos)
+    {
+        if (*pos == '\0' || strchr(separators, *pos) == nullptr) continue;
+        if (pos > prev)
+        { result.emplace_back(prev, static_cast<size_t>(pos - prev)); }
+        prev = pos + 1;
+    }
+    if (prev < end) { result.emplace_back(prev, static_cast<size_t>(end - prev)); }
+}
+// Why a number did not parse
+enum class ParseStatus
+{
+    Ok,
+    // not a number, or a number followed by something else
+    Invalid,
+    // a number too large for its type
+    OutOfRange
+};
+
+// Parse the whole of str as a base 10 integer
+inline ParseStatus read_int(const string_view& str, long long& value)
+{
+    const char* p = str.begin();
+    const char* end = str.end();
+    bool neg = false;
+    if (p != end && (*p == '-' || *p == '+')) neg = (*p++ == '-');
+    if (p == end) return ParseStatus::Invalid;
+    unsigned long long x = 0;
+    // 18 digits cannot overflow, only longer numbers need the check
+    const char* unchecked = end - p > 18 ? p + 18 : end;
+    for (; p != unchecked; ++p)
+    {
+        const unsigned digit = static_cast<unsigned char>(*p - '0');
+        if (digit > 9) return ParseStatus::Invalid;
+        x = x * 10 + digit;
+    }
+    const unsigned long long limit =
+        static_cast<unsigned long long>(std::numeric_limits<long long>::max())
+        + (neg ? 1 : 0);
+    bool overflow = false;
+    for (; p != end; ++p)
+    {
+        const unsigned digit = static_cast<unsigned char>(*p - '0');
+        if (digit > 9) return ParseStatus::Invalid;
+        overflow |= x > (limit - digit) / 10;
+        x = x * 10 + digit;
+    }
+    if (overflow) return ParseStatus::OutOfRange;
+    value = neg ? static_cast<long long>(0 - x) : static_cast<long long>(x);
+    return ParseStatus::Ok;
+}
+
+// Parse the whole of str as a base 10 integer. Return false if it is not one
+// or does not fit
+inline bool parse_int(const string_view& str, long long& value)
+{
+    return read_int(str, value) == ParseStatus::Ok;
+}
+
+// Parse a size such as "512", "64K", "256M" or "8G" (an optional B may
+// follow the suffix). number is the number given and unit what the suffix
+// multiplies it by, 1 without one. Return false if str is not a size
+inline bool parse_size(const std::string& str, unsigned long long& number,
+                       unsigned long long& unit)
+{
+    size_t end = 0;
+    number = 0;
+    while (end < str.size() && str[end] >= '0' && str[end] <= '9')
+    {
+        number = number * 10 + static_cast<unsigned long long>(str[end] - '0');
+        ++end;
+    }
+    if (end == 0 || end > 18) return false;
+    std::string suffix = str.substr(end);
+    if (suffix.size() == 2 && (suffix[1] == 'B' || suffix[1] == 'b'))
+    { suffix.resize(1); }
+    unit = 1;
+    if (suffix.empty()) return true;
+    if (suffix.size() != 1) return false;
+    switch (suffix[0])
+    {
+    case 'K':
+    case 'k': unit = 1ULL << 10; return true;
+    case 'M':
+    case 'm': unit = 1ULL << 20; return true;
+    case 'G':
+    case 'g': unit = 1ULL << 30; return true;
+    default: return false;
+    }
+}
+
+// read_double for the numbers its fast path cannot round exactly
+ParseStatus read_double_slow(const string_view& str, double& value);
+
+// Parse the whole of str as a decimal number: an optional sign, digits with
+// an optional point and an optional exponent. The result is correctly
+// rounded and the same in every locale. Infinity, NaN and hexadecimal are not
+// numbers here
+inline ParseStatus read_double(const string_view& str, double& value)
+{
+    // powers of ten a double holds exactly
+    static const double power[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                   1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                   1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                   1e18, 1e19, 1e20, 1e21, 1e22};
+    const char* p = str.begin();
+    const char* end = str.end();
+    bool neg = false;
+    if (p != end && (*p == '-' || *p == '+')) neg = (*p++ == '-');
+    // the first 19 significant digits, times ten to the exponent
+    unsigned long long mantissa = 0;
+    int num_digit = 0;
+    long long exponent = 0;
+    // a non-zero digit did not fit in the mantissa
+    bool truncated = false;
+    bool any_digit = false;
+    bool fraction = false;
+    for (; p != end; ++p)
+    {
+        if (*p == '.' && !fraction)
+        {
+            fraction = true;
+            continue;
+        }
+        const unsigned digit = static_cast<unsigned char>(*p - '0');
+        if (digit > 9) break;
+        any_digit = true;
+        if (num_digit < 19)
+        {
+            mantissa = mantissa * 10 + digit;
+            num_digit += mantissa != 0;
+            exponent -= fraction;
+        }
+        else
+        {
+            truncated |= digit != 0;
+            exponent += !fraction;
+        }
+    }
+    if (!any_digit) return ParseStatus::Invalid;
+    if (p != end && (*p == 'e' || *p == 'E'))
+    {
+        ++p;
+        bool neg_exponent = false;
+        if (p != end && (*p == '-' || *p == '+'))
+            neg_exponent = (*p++ == '-');
+        if (p == end) return ParseStatus::Invalid;
+        long long e = 0;
+        for (; p != end; ++p)
+        {
+            const unsigned digit = static_cast<unsigned char>(*p - '0');
+            if (digit > 9) return ParseStatus::Invalid;
+            // far beyond the range of a double already
+            if (e < 100000) e = e * 10 + digit;
+        }
+        exponent += neg_exponent ? -e : e;
+    }
+    if (p != end) return ParseStatus::Invalid;
+    if (mantissa == 0)
+    {
+        value = neg ? -0.0 : 0.0;
+        return ParseStatus::Ok;
+    }
+    // Clinger's fast path: the mantissa and the power of ten are both exact,
+    // so the one multiplication or division rounds correctly
+    if (truncated || mantissa > (1ULL << 53) || exponent < -22 || exponent > 22)
+    { return read_double_slow(str, value); }
+    const double x = static_cast<double>(mantissa);
+    value = exponent < 0 ? x / power[-exponent] : x * power[exponent];
+    if (neg) value = -value;
+    return ParseStatus::Ok;
+}
+
+// Parse the whole of str as a floating point number
+inline bool parse_double(const string_view& str, double& value)
+{
+    return read_double(str, value) == ParseStatus::Ok;
+}
+
+// Parse the whole of str as an integer of type T, throw if it is not one or
+// does not fit
+template <typename T> inline T integer_of(const string_view& str)
+{
+    long long value = 0;
+    ParseStatus status = read_int(str, value);
+    const bool fits =
+        value >= 0 ? static_cast<unsigned long long>(value)
+                         <= static_cast<unsigned long long>(
+                             std::numeric_limits<T>::max())
+                   : value >= static_cast<long long>(
+                         std::numeric_limits<T>::min());
+    if (status == ParseStatus::Ok && !fits) status = ParseStatus::OutOfRange;
+    if (status == ParseStatus::OutOfRange)
+    { throw std::runtime_error("Input out of range: " + str.to_string()); }
+    if (status != ParseStatus::Ok)
+    {
+        throw std::runtime_error("Unable to convert the input: "
+                                 + str.to_string());
+    }
+    return static_cast<T>(value);
+}
 template <typename T>
-inline T convert(const std::string& str)
+inline T convert(const std::string& str, std::true_type /* integral */,
+                 std::false_type)
+{
+    return integer_of<T>(str);
+}
+template <typename T>
+inline T convert(const std::string& str, std::false_type,
+                 std::true_type /* floating point */)
+{
+    double value = 0;
+    const ParseStatus status = read_double(str, value);
+    if (status == ParseStatus::OutOfRange)
+    { throw std::runtime_error("Input out of range: " + str); }
+    if (status != ParseStatus::Ok)
+    { throw std::runtime_error("Unable to convert the input: " + str); }
+    return static_cast<T>(value);
+}
+template <typename T>
+inline T convert(const std::string& str, std::false_type, std::false_type)
 {
     std::istringstream iss(str);
     T obj;
@@ -388,6 +731,12 @@ inline T convert(const std::string& str)
     { throw std::runtime_error("Unable to convert the input"); }
     return obj;
 }
+// numbers go through read_int and read_double, anything else is streamed
+template <typename T>
+inline T convert(const std::string& str)
+{
+    return convert<T>(str, std::is_integral<T>(), std::is_floating_point<T>());
+}
 template <typename T>
 inline std::string to_string(T value)
 {
@@ -416,6 +765,14 @@ inline void trim(std::string& s)
     ltrim(s);
     rtrim(s);
 };
+// trim both ends of a view, nothing is copied
+inline void trim(string_view& s)
+{
+    while (!s.empty() && std::isspace(static_cast<unsigned char>(s.front())))
+        s.remove_prefix(1);
+    while (!s.empty() && std::isspace(static_cast<unsigned char>(s.back())))
+        s.remove_suffix(1);
+}
 // trim from start (copying)
 inline std::string ltrimmed(std::string s)
 {
@@ -1077,27 +1434,6 @@ inline bool isNumeric(std::string s)
 
 inline int string_to_int(const char* p)
 {
-    int x = 0;
-    bool neg = false;
-    if (*p == '-')
-    {
-        neg = true;
-        ++p;
-    }
-    else if (*p == '+')
-    {
-        ++p;
-    }
-    else if (*p < '0' || *p > '9')
-    {
-        throw std::runtime_error("Error: Not an integer\n");
-    }
-    while (*p >= '0' && *p <= '9')
-    {
-        x = (x * 10) + (*p - '0');
-        ++p;
-    }
-    if (neg) { x = -x; }
-    return x;
+    return integer_of<int>(string_view(p, strlen(p)));
 }
 }
@@ -0,0 +1,114 @@
+#include "pheno_tables.h"
+#include <stdexcept>
+
+namespace
+{
+// declared type of Pheno in each table of the typed layout, in Storage order
+const char* typed_pheno[] = {"INTEGER", "REAL", "TEXT"};
+}
+
+PhenoTables::PhenoTables(sqlite3* db, const bool typed, const bool clustered)
+    : m_db(db), m_typed(typed), m_clustered(clustered)
+{
+    for (auto&& name : names(typed)) m_tables.emplace_back(new SQL(name, db));
+}
+
+std::vector<std::string> PhenoTables::names(const bool typed)
+{
+    if (!typed) return {"PHENOTYPE"};
+    return {"PHENO_INTEGER", "PHENO_REAL", "PHENO_TEXT"};
+}
+
+void PhenoTables::prepare(const bool append)
+{
+    bool created = false;
+    for (size_t i = 0; i < m_tables.size(); ++i)
+    {
+        SQL& table = *m_tables[i];
+        const std::string name = names(m_typed)[i];
+        const std::string pheno = m_typed ? typed_pheno[i] : "INT";
+        if (!append || !table.use_existing())
+        {
+            created = true;
+            // with a clustered layout, rows are stored in primary key order,
+            // so extracting a field reads a contiguous range and needs no
+            // separate index
+            std::string sql = "CREATE TABLE " + name
+                              + "(ID INT NOT NULL,Instance INT NOT NULL,";
+            if (m_clustered) sql += "Array INT NOT NULL,";
+            sql += "Pheno " + pheno + " NOT NULL,FieldID INT NOT NULL,";
+            if (m_clustered)
+            { sql += "PRIMARY KEY (FieldID, Instance, Array, ID),"; }
+            sql += "FOREIGN KEY (ID) REFERENCES PARTICIPANT(ID),"
+                   "FOREIGN KEY (FieldID) REFERENCES DATA_META(FieldID))";
+            if (m_clustered) sql += " WITHOUT ROWID";
+            table.create_table(sql + ";");
+        }
+        if (m_clustered)
+        {
+            table.prep_insert("INSERT INTO " + name
+                                  + "(ID, Instance, FieldID, Pheno, Array)",
+                              {SQL::Type::Integer, SQL::Type::Integer,
+                               SQL::Type::Integer, SQL::Type::Numeric,
+                               SQL::Type::Integer});
+        }
+        else
+        {
+            table.prep_insert("INSERT INTO " + name
+                                  + "(ID, Instance, FieldID, Pheno)",
+                              {SQL::Type::Integer, SQL::Type::Integer,
+                               SQL::Type::Integer, SQL::Type::Numeric});
+        }
+    }
+    if (!m_typed || !created) return;
+    const std::string columns =
+        m_clustered ? "ID, Instance, Array, Pheno, FieldID"
+                    : "ID, Instance, Pheno, FieldID";
+    std::string view = "CREATE VIEW IF NOT EXISTS PHENOTYPE AS ";
+    for (auto&& name : names(m_typed))
+    {
+        if (name != names(m_typed).front()) view += " UNION ALL ";
+        view += "SELECT " + columns + " FROM " + name;
+    }
+    char* zErrMsg = nullptr;
+    if (sqlite3_exec(m_db, view.c_str(), nullptr, nullptr, &zErrMsg)
+        != SQLITE_OK)
+    {
+        const std::string error = zErrMsg;
+        sqlite3_free(zErrMsg);
+        throw std::runtime_error("SQL error: " + error);
+    }
+}
+
+void PhenoTables::flush()
+{
+    for (auto&& table : m_tables) table->flush();
+}
+
+void PhenoTables::add_indexes(IndexPlan& indexes) const
+{
+    for (auto&& table : names(m_typed))
+    {
+        // PHENOTYPE_INDEX of PHENO_REAL is PHENO_REAL_INDEX
+        const std::string prefix = table + "_";
+        if (m_clustered)
+        {
+            // entries of a WITHOUT ROWID table carry the primary key, so
+            // this covers lookups by participant
+            indexes.add(IndexPlan::Profile::Extraction, table,
+                        prefix + "ID_INDEX", {"ID", "Pheno"});
+            continue;
+        }
+        indexes.add(IndexPlan::Profile::Minimal, table,
+                    prefix + "INSTANCE_FIELD_INDEX",
+                    {"FieldID", "Instance", "ID"});
+        indexes.add(IndexPlan::Profile::Extraction, table, prefix + "INDEX",
+                    {"ID"});
+        indexes.add(IndexPlan::Profile::Extraction, table,
+                    prefix + "NO_INSTANCE_INDEX", {"Pheno", "FieldID", "ID"});
+        indexes.add(IndexPlan::Profile::Full, table,
+                    prefix + "INSTANCE_INDEX", {"Instance", "Pheno"});
+        indexes.add(IndexPlan::Profile::Full, table, prefix + "FULL_INDEX",
+                    {"Instance", "Pheno", "FieldID", "ID"});
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef PROCESS_PHENO_TABLES_H
+#define PROCESS_PHENO_TABLES_H
+
+#include "field_catalog.h"
+#include "index_plan.h"
+#include "sql.h"
+#include <cstdint>
+#include <memory>
+#include <sqlite3.h>
+#include <string>
+#include <vector>
+
+// The tables the phenotype entries go into. By default that is PHENOTYPE,
+// whose Pheno column takes integers, reals and text alike. The typed layout
+// routes each field by its ValueType instead: Integer fields, integer codes
+// of categorical fields (and keys into PHENO_META) to PHENO_INTEGER,
+// Continuous fields to PHENO_REAL and all others to PHENO_TEXT, where text is
+// never mistaken for a number. PHENOTYPE is then a view over the three, for
+// queries that do not care about the type
+class PhenoTables
+{
+public:
+    // table of the typed layout an entry goes to
+    enum class Storage : uint8_t
+    {
+        Integer,
+        Real,
+        Text
+    };
+    PhenoTables(sqlite3* db, const bool typed, const bool clustered);
+    PhenoTables(const PhenoTables&) = delete;
+    PhenoTables& operator=(const PhenoTables&) = delete;
+    // names of the tables holding the entries in a layout
+    static std::vector<std::string> names(const bool typed);
+    static Storage storage(ValueType type, const bool encoded)
+    {
+        if (encoded || type == ValueType::Integer) return Storage::Integer;
+        return type == ValueType::Continuous ? Storage::Real : Storage::Text;
+    }
+    // Table a single value of a field goes to. Most categorical codings are
+    // integers, those codes go to PHENO_INTEGER so that PHENOTYPE compares
+    // them as numbers, the same as the untyped layout does. Only codes that
+    // are not integers end up in PHENO_TEXT
+    Storage route(Storage storage, ValueType type,
+                  const misc::string_view& value) const
+    {
+        if (!m_typed || storage != Storage::Text
+            || (type != ValueType::CategoricalSingle
+                && type != ValueType::CategoricalMultiple))
+        { return storage; }
+        long long code;
+        return misc::parse_int(value, code) ? Storage::Integer : Storage::Text;
+    }
+    // Create the tables, or take over those of an earlier run when appending
+    void prepare(const bool append);
+    // how the text of a value of storage is bound
+    SQL::Type bind_type(Storage storage) const
+    {
+        if (!m_typed) return SQL::Type::Numeric;
+        switch (storage)
+        {
+        case Storage::Integer: return SQL::Type::Integer;
+        case Storage::Real: return SQL::Type::Real;
+        case Storage::Text: break;
+        }
+        return SQL::Type::Text;
+    }
+    void insert(Storage storage, const SQL::Value& id, sqlite3_int64 instance,
+                sqlite3_int64 field, sqlite3_int64 array,
+                const SQL::Value& value)
+    {
+        SQL& table = *m_tables[m_typed ? static_cast<size_t>(storage) : 0];
+        if (m_clustered) { table.insert({id, instance, field, value, array}); }
+        else
+        {
+            table.insert({id, instance, field, value});
+        }
+    }
+    void flush();
+    // register the indexes of each table
+    void add_indexes(IndexPlan& indexes) const;
+
+private:
+    sqlite3* m_db;
+    bool m_typed;
+    bool m_clustered;
+    std::vector<std::unique_ptr<SQL>> m_tables;
+};
+
+#endif // PROCESS_PHENO_TABLES_H
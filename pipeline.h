@@ -0,0 +1,189 @@
+#ifndef PROCESS_PIPELINE_H
+#define PROCESS_PIPELINE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <string>
+
+// FIFO shared between two pipeline stages. push blocks while the queue is
+// full and pop blocks while it is empty. Once closed, push is refused and pop
+// returns false after the remaining items are drained
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity)
+        : m_capacity(capacity == 0 ? 1 : capacity)
+    {
+    }
+    bool push(T&& item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_not_full.wait(
+            lock, [this] { return m_closed || m_queue.size() < m_capacity; });
+        if (m_closed) return false;
+        m_queue.push_back(std::move(item));
+        m_not_empty.notify_one();
+        return true;
+    }
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_not_empty.wait(lock, [this] { return m_closed || !m_queue.empty(); });
+        if (m_queue.empty()) return false;
+        item = std::move(m_queue.front());
+        m_queue.pop_front();
+        m_not_full.notify_one();
+        return true;
+    }
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+        m_not_full.notify_all();
+        m_not_empty.notify_all();
+    }
+
+private:
+    std::deque<T> m_queue;
+    std::mutex m_mutex;
+    std::condition_variable m_not_full;
+    std::condition_variable m_not_empty;
+    size_t m_capacity;
+    bool m_closed = false;
+};
+
+// Hand items to a single consumer strictly in sequence order, whatever order
+// the producers finish them in. A producer more than `window` items ahead of
+// the consumer blocks, so the reorder buffer never grows beyond the window.
+// The item the consumer is waiting for is always accepted, so this cannot
+// deadlock. Producers call done() when they finish; pop returns false once all
+// of them are done and nothing is left in sequence
+template <typename T>
+class OrderedQueue
+{
+public:
+    OrderedQueue(size_t window, size_t num_producer)
+        : m_window(window == 0 ? 1 : window), m_producers(num_producer)
+    {
+    }
+    bool push(size_t seq, T&& item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock,
+                    [&] { return m_closed || seq < m_next + m_window; });
+        if (m_closed) return false;
+        m_pending.emplace(seq, std::move(item));
+        m_cond.notify_all();
+        return true;
+    }
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [this] {
+            return m_closed || m_producers == 0
+                   || (!m_pending.empty() && m_pending.begin()->first == m_next);
+        });
+        if (m_pending.empty() || m_pending.begin()->first != m_next)
+            return false;
+        item = std::move(m_pending.begin()->second);
+        m_pending.erase(m_pending.begin());
+        ++m_next;
+        m_cond.notify_all();
+        return true;
+    }
+    void done()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_producers != 0) --m_producers;
+        m_cond.notify_all();
+    }
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+        m_cond.notify_all();
+    }
+
+private:
+    std::map<size_t, T> m_pending;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    size_t m_window;
+    size_t m_next = 0;
+    size_t m_producers;
+    bool m_closed = false;
+};
+
+// Work done by one pipeline stage. Only time spent working is counted, time
+// spent blocked on a queue is not, so the rate is what the stage could
+// sustain on its own
+class StageStat
+{
+public:
+    typedef std::chrono::steady_clock clock;
+    explicit StageStat(const std::string& name) : m_name(name) {}
+    void add(const clock::time_point& start, unsigned long long items,
+             unsigned long long bytes = 0)
+    {
+        m_seconds +=
+            std::chrono::duration<double>(clock::now() - start).count();
+        m_items += items;
+        m_bytes += bytes;
+    }
+    // parser threads keep a private copy and fold it in when they finish
+    void merge(const StageStat& other)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_seconds += other.m_seconds;
+        m_items += other.m_items;
+        m_bytes += other.m_bytes;
+    }
+    void report(const std::string& unit, size_t num_thread = 1) const
+    {
+        // busy time is summed over threads, the rate is for the whole stage
+        const double sec =
+            (m_seconds > 0 ? m_seconds : 1e-9) / (num_thread ? num_thread : 1);
+        fprintf(stderr, "  %-8s %llu %s in %.2fs busy", m_name.c_str(), m_items,
+                unit.c_str(), m_seconds);
+        if (num_thread > 1) fprintf(stderr, " over %zu threads", num_thread);
+        fprintf(stderr, " (%.0f %s/s", m_items / sec, unit.c_str());
+        if (m_bytes) fprintf(stderr, ", %.2f MB/s", m_bytes / sec / 1048576.0);
+        fprintf(stderr, ")\n");
+    }
+
+private:
+    std::mutex m_mutex;
+    std::string m_name;
+    double m_seconds = 0;
+    unsigned long long m_items = 0;
+    unsigned long long m_bytes = 0;
+};
+
+// Keep the first exception thrown by any stage so it can be rethrown on the
+// calling thread once every stage has been stopped and joined
+class StageError
+{
+public:
+    void set(std::exception_ptr error)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_error) m_error = error;
+    }
+    void rethrow()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_error) std::rethrow_exception(m_error);
+    }
+
+private:
+    std::mutex m_mutex;
+    std::exception_ptr m_error;
+};
+
+#endif // PROCESS_PIPELINE_H
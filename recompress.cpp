@@ -0,0 +1,325 @@
+#include "recompress.h"
+#include "pipeline.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include <zlib.h>
+#ifdef UKB_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+namespace
+{
+// largest BGZF input block, small enough that even stored data fits the
+// 64KB block size limit (same as bgzip)
+const size_t bgzf_block_size = 65280;
+const size_t bgzf_max_size = 65536;
+const size_t bgzf_header_size = 18;
+const size_t job_size = 16 * bgzf_block_size;
+// an empty block marks the end of a BGZF file
+const unsigned char bgzf_eof[28] = {
+    0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff,
+    0x06, 0x00, 0x42, 0x43, 0x02, 0x00, 0x1b, 0x00, 0x03, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+
+struct Job
+{
+    std::vector<char> data;
+    std::vector<char> compressed;
+    // compressed and decompressed size of each zstd frame
+    std::vector<std::pair<uint32_t, uint32_t>> frames;
+};
+
+void put_u32(std::vector<char>& out, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+    { out.push_back(static_cast<char>((value >> (8 * i)) & 0xff)); }
+}
+
+void put_u32(unsigned char* out, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+    { out[i] = static_cast<unsigned char>((value >> (8 * i)) & 0xff); }
+}
+
+// compress one block into out, return false if it does not fit
+bool deflate_block(const char* data, size_t size, int level,
+                   unsigned char* out, size_t& out_size)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY)
+        != Z_OK)
+    { throw std::runtime_error("Error: Failed to initialize zlib"); }
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream.avail_in = static_cast<uInt>(size);
+    stream.next_out = out;
+    stream.avail_out = static_cast<uInt>(out_size);
+    const int status = deflate(&stream, Z_FINISH);
+    out_size = stream.total_out;
+    deflateEnd(&stream);
+    return status == Z_STREAM_END;
+}
+
+void compress_bgzf(Job& job, int level)
+{
+    unsigned char block[bgzf_max_size];
+    for (size_t begin = 0; begin < job.data.size(); begin += bgzf_block_size)
+    {
+        const size_t size = std::min(bgzf_block_size, job.data.size() - begin);
+        const char* data = job.data.data() + begin;
+        size_t deflated = bgzf_max_size - bgzf_header_size - 8;
+        if (!deflate_block(data, size, level, block + bgzf_header_size,
+                           deflated))
+        {
+            // incompressible, store it as is
+            deflated = bgzf_max_size - bgzf_header_size - 8;
+            if (!deflate_block(data, size, 0, block + bgzf_header_size,
+                               deflated))
+            { throw std::runtime_error("Error: BGZF block overflow"); }
+        }
+        const size_t block_size = bgzf_header_size + deflated + 8;
+        memcpy(block, bgzf_eof, bgzf_header_size);
+        block[16] = static_cast<unsigned char>((block_size - 1) & 0xff);
+        block[17] = static_cast<unsigned char>((block_size - 1) >> 8);
+        const uLong crc =
+            crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(data),
+                  static_cast<uInt>(size));
+        put_u32(block + bgzf_header_size + deflated, static_cast<uint32_t>(crc));
+        put_u32(block + bgzf_header_size + deflated + 4,
+                static_cast<uint32_t>(size));
+        job.compressed.insert(job.compressed.end(), block, block + block_size);
+    }
+}
+
+void compress_zstd(Job& job, int level)
+{
+#ifdef UKB_WITH_ZSTD
+    // one frame per job, so every frame can be decompressed on its own
+    job.compressed.resize(ZSTD_compressBound(job.data.size()));
+    const size_t size =
+        ZSTD_compress(job.compressed.data(), job.compressed.size(),
+                      job.data.data(), job.data.size(), level);
+    if (ZSTD_isError(size))
+    {
+        throw std::runtime_error(std::string("Error: zstd compression failed: ")
+                                 + ZSTD_getErrorName(size));
+    }
+    job.compressed.resize(size);
+    job.frames.emplace_back(static_cast<uint32_t>(size),
+                            static_cast<uint32_t>(job.data.size()));
+#else
+    (void) job;
+    (void) level;
+    throw std::runtime_error(
+        "Error: This program was built without zstd support");
+#endif
+}
+
+// the seekable zstd seek table, a skippable frame listing every frame
+std::vector<char>
+seek_table(const std::vector<std::pair<uint32_t, uint32_t>>& frames)
+{
+    std::vector<char> table;
+    put_u32(table, 0x184D2A5E);
+    put_u32(table, static_cast<uint32_t>(frames.size() * 8 + 9));
+    for (auto&& frame : frames)
+    {
+        put_u32(table, frame.first);
+        put_u32(table, frame.second);
+    }
+    put_u32(table, static_cast<uint32_t>(frames.size()));
+    // no checksums
+    table.push_back(0);
+    put_u32(table, 0x8F92EAB1);
+    return table;
+}
+}
+
+void recompress(const std::string& input, const std::string& output,
+                Decompressor::Format format, int level, size_t num_thread)
+{
+#ifndef UKB_WITH_ZSTD
+    if (format == Decompressor::Format::SeekableZstd)
+    {
+        throw std::runtime_error(
+            "Error: This program was built without zstd support");
+    }
+#endif
+    if (num_thread == 0) num_thread = 1;
+    const int fd = (input == "-") ? STDIN_FILENO : open(input.c_str(), O_RDONLY);
+    if (fd == -1)
+    { throw std::runtime_error("Error: Cannot open input file: " + input); }
+    // read what is already compressed through the decompressor
+    char magic[Decompressor::magic_size];
+    size_t num_magic = 0;
+    while (num_magic < sizeof(magic))
+    {
+        const ssize_t num_read =
+            read(fd, magic + num_magic, sizeof(magic) - num_magic);
+        if (num_read == -1 && errno == EINTR) continue;
+        if (num_read <= 0) break;
+        num_magic += static_cast<size_t>(num_read);
+    }
+    std::unique_ptr<Decompressor> decompressor;
+    const Decompressor::Format input_format =
+        Decompressor::detect(magic, num_magic);
+    size_t prefix_pos = 0;
+    if (input_format != Decompressor::Format::None)
+    {
+        decompressor.reset(new Decompressor(
+            fd, input_format, std::vector<char>(magic, magic + num_magic),
+            num_thread));
+        prefix_pos = num_magic;
+    }
+    auto&& read_block = [&](std::vector<char>& data) {
+        data.resize(job_size);
+        size_t have = std::min(num_magic - prefix_pos, data.size());
+        memcpy(data.data(), magic + prefix_pos, have);
+        prefix_pos += have;
+        while (have < data.size())
+        {
+            ssize_t num_read;
+            if (decompressor)
+            {
+                num_read = static_cast<ssize_t>(
+                    decompressor->read(data.data() + have, data.size() - have));
+            }
+            else
+            {
+                num_read = read(fd, data.data() + have, data.size() - have);
+                if (num_read == -1 && errno == EINTR) continue;
+            }
+            if (num_read < 0)
+            { throw std::runtime_error("Error: Failed to read " + input); }
+            if (num_read == 0) break;
+            have += static_cast<size_t>(num_read);
+        }
+        data.resize(have);
+        return have != 0;
+    };
+    FILE* out = fopen(output.c_str(), "wb");
+    if (out == nullptr)
+    {
+        if (fd != STDIN_FILENO) close(fd);
+        throw std::runtime_error("Error: Cannot create output file: " + output);
+    }
+    // read here, compress on the workers and write in order on the writer
+    BoundedQueue<std::pair<size_t, Job>> jobs(2 * num_thread);
+    OrderedQueue<Job> done(2 * num_thread + 2, num_thread);
+    StageError failure;
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < num_thread; ++i)
+    {
+        workers.emplace_back([&]() {
+            std::pair<size_t, Job> job;
+            try
+            {
+                while (jobs.pop(job))
+                {
+                    if (format == Decompressor::Format::Bgzf)
+                    { compress_bgzf(job.second, level); }
+                    else
+                    {
+                        compress_zstd(job.second, level);
+                    }
+                    job.second.data.clear();
+                    if (!done.push(job.first, std::move(job.second))) break;
+                }
+            }
+            catch (...)
+            {
+                failure.set(std::current_exception());
+                jobs.close();
+                done.close();
+            }
+            done.done();
+        });
+    }
+    unsigned long long raw = 0, written = 0;
+    std::vector<std::pair<uint32_t, uint32_t>> frames;
+    std::thread writer([&]() {
+        Job job;
+        while (done.pop(job))
+        {
+            if (fwrite(job.compressed.data(), 1, job.compressed.size(), out)
+                != job.compressed.size())
+            {
+                failure.set(std::make_exception_ptr(std::runtime_error(
+                    "Error: Failed to write " + output)));
+                jobs.close();
+                done.close();
+                return;
+            }
+            written += job.compressed.size();
+            frames.insert(frames.end(), job.frames.begin(), job.frames.end());
+        }
+    });
+    try
+    {
+        size_t seq = 0;
+        std::pair<size_t, Job> job;
+        while (read_block(job.second.data))
+        {
+            raw += job.second.data.size();
+            job.first = seq++;
+            if (!jobs.push(std::move(job))) break;
+            job = std::pair<size_t, Job>();
+        }
+    }
+    catch (...)
+    {
+        failure.set(std::current_exception());
+        done.close();
+    }
+    jobs.close();
+    for (auto&& worker : workers) worker.join();
+    writer.join();
+    decompressor.reset();
+    if (fd != STDIN_FILENO) close(fd);
+    try
+    {
+        failure.rethrow();
+    }
+    catch (...)
+    {
+        fclose(out);
+        throw;
+    }
+    std::vector<char> tail;
+    if (format == Decompressor::Format::Bgzf)
+    { tail.assign(bgzf_eof, bgzf_eof + sizeof(bgzf_eof)); }
+    else
+    {
+        // nothing but a seek table would not start with the zstd magic, and
+        // be read back as plain text
+        if (frames.empty())
+        {
+            Job empty;
+            compress_zstd(empty, level);
+            tail = empty.compressed;
+            frames = empty.frames;
+        }
+        const std::vector<char> table = seek_table(frames);
+        tail.insert(tail.end(), table.begin(), table.end());
+    }
+    const bool failed =
+        fwrite(tail.data(), 1, tail.size(), out) != tail.size();
+    if (fclose(out) != 0 || failed)
+    { throw std::runtime_error("Error: Failed to write " + output); }
+    written += tail.size();
+    std::cerr << "Recompressed " << input << " ("
+              << Decompressor::name(input_format) << ", " << raw / 1048576.0
+              << " MB uncompressed) to " << output << " ("
+              << Decompressor::name(format) << ", " << written / 1048576.0
+              << " MB)" << std::endl;
+}
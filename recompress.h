@@ -0,0 +1,13 @@
+#ifndef PROCESS_RECOMPRESS_H
+#define PROCESS_RECOMPRESS_H
+
+#include "decompress.h"
+#include <string>
+
+// Rewrite input (plain, gzip or zstd, "-" for stdin) as BGZF or seekable zstd
+// so it can be decompressed by several threads. BGZF is read by any gzip tool,
+// seekable zstd by any zstd tool. Blocks are compressed by num_thread threads
+void recompress(const std::string& input, const std::string& output,
+                Decompressor::Format format, int level, size_t num_thread);
+
+#endif // PROCESS_RECOMPRESS_H
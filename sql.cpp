@@ -1,8 +1,18 @@
 #include "sql.h"
+#include <algorithm>
+
+// upper bound on rows in one multi-row insert
+static const size_t max_insert_row = 256;
 
 SQL::SQL(const std::string& name, sqlite3* dat) : m_db(dat), m_table_name(name)
 {
 }
+SQL::~SQL()
+{
+    // rows still pending are dropped, the loader must flush() before it ends
+    // its transaction
+    if (m_statement != nullptr) sqlite3_finalize(m_statement);
+}
 void SQL::create_table(const std::string& sql)
 {
     try
@@ -18,6 +28,27 @@ void SQL::create_table(const std::string& sql)
     }
 }
 
+bool SQL::use_existing()
+{
+    sqlite3_stmt* statement = nullptr;
+    if (sqlite3_prepare_v2(m_db,
+                           "SELECT 1 FROM sqlite_master WHERE type = 'table' "
+                           "AND name = ?",
+                           -1, &statement, nullptr)
+        != SQLITE_OK)
+    {
+        throw std::runtime_error("Error: Failed to look up table "
+                                 + m_table_name + ": "
+                                 + std::string(sqlite3_errmsg(m_db)));
+    }
+    sqlite3_bind_text(statement, 1, m_table_name.c_str(), -1, SQLITE_STATIC);
+    m_table_created = sqlite3_step(statement) == SQLITE_ROW;
+    sqlite3_finalize(statement);
+    if (m_table_created)
+    { std::cerr << "Table: " << m_table_name << " found, appending to it\n"; }
+    return m_table_created;
+}
+
 void SQL::prep_statement(const std::string& sql)
 {
     if (!m_table_created)
@@ -25,7 +56,138 @@ void SQL::prep_statement(const std::string& sql)
         throw std::runtime_error("Error: Table: " + m_table_name
                                  + " not created");
     }
-    sqlite3_prepare_v2(m_db, sql.c_str(), -1, &m_statement, nullptr);
+    if (m_statement != nullptr) sqlite3_finalize(m_statement);
+    m_statement = nullptr;
+    if (sqlite3_prepare_v2(m_db, sql.c_str(), -1, &m_statement, nullptr)
+        != SQLITE_OK)
+    {
+        throw std::runtime_error("Error: Failed to prepare statement for "
+                                 + m_table_name + ": "
+                                 + std::string(sqlite3_errmsg(m_db)));
+    }
+    m_num_column =
+        static_cast<size_t>(sqlite3_bind_parameter_count(m_statement));
+    m_rows_per_statement = 1;
+    m_num_pending = 0;
+    m_params.assign(m_num_column, Param());
+    m_text_buffer.clear();
+}
+
+std::string SQL::insert_sql(size_t num_row) const
+{
+    std::string row = "(";
+    for (size_t i = 0; i < m_num_column; ++i) row += (i == 0 ? "?" : ",?");
+    row += ")";
+    std::string sql;
+    sql.reserve(m_insert.size() + 8 + num_row * (row.size() + 1));
+    sql = m_insert + " VALUES ";
+    for (size_t i = 0; i < num_row; ++i)
+    {
+        if (i != 0) sql += ",";
+        sql += row;
+    }
+    return sql;
+}
+
+void SQL::prep_insert(const std::string& insert, const std::vector<Type>& types)
+{
+    if (types.empty())
+    {
+        throw std::runtime_error("Error: No column to insert into "
+                                 + m_table_name);
+    }
+    m_insert = insert;
+    m_num_column = types.size();
+    // each row takes one variable per column, fit as many rows as allowed.
+    // Builds with a large variable limit would give statements of thousands
+    // of rows, which are slower to run than a few hundred at a time
+    const size_t max_variable = static_cast<size_t>(
+        sqlite3_limit(m_db, SQLITE_LIMIT_VARIABLE_NUMBER, -1));
+    const size_t num_row = std::max<size_t>(
+        1, std::min(max_insert_row, max_variable / m_num_column));
+    prep_statement(insert_sql(num_row), types);
+    m_num_column = types.size();
+    m_rows_per_statement = num_row;
+    m_params.assign(num_row * m_num_column, Param());
+}
+
+void SQL::flush()
+{
+    if (m_num_pending == 0) return;
+    if (m_rows_per_statement == 1)
+    {
+        execute(m_statement, m_num_pending);
+        return;
+    }
+    // the leftover rows need a statement of their own size
+    sqlite3_stmt* tail = nullptr;
+    if (sqlite3_prepare_v2(m_db, insert_sql(m_num_pending).c_str(), -1, &tail,
+                           nullptr)
+        != SQLITE_OK)
+    {
+        throw std::runtime_error("Error: Failed to prepare statement for "
+                                 + m_table_name + ": "
+                                 + std::string(sqlite3_errmsg(m_db)));
+    }
+    try
+    {
+        execute(tail, m_num_pending);
+    }
+    catch (...)
+    {
+        sqlite3_finalize(tail);
+        throw;
+    }
+    sqlite3_finalize(tail);
+}
+
+void SQL::execute(sqlite3_stmt* statement, size_t num_row)
+{
+    const size_t num_param = num_row * m_num_column;
+    for (size_t i = 0; i < num_param; ++i)
+    {
+        const Param& cur = m_params[i];
+        const int idx = static_cast<int>(i + 1);
+        const char* text = (cur.text != nullptr)
+                               ? cur.text
+                               : m_text_buffer.data() + cur.offset;
+        int status = SQLITE_OK;
+        switch (cur.kind)
+        {
+        case Param::Kind::Null: status = sqlite3_bind_null(statement, idx); break;
+        case Param::Kind::Integer:
+            status = sqlite3_bind_int64(statement, idx, cur.int_value);
+            break;
+        case Param::Kind::Real:
+            status = sqlite3_bind_double(statement, idx, cur.real_value);
+            break;
+        case Param::Kind::Text:
+            // a null pointer would bind NULL, empty text stays ''
+            status = sqlite3_bind_text(statement, idx, cur.size ? text : "",
+                                       static_cast<int>(cur.size), SQLITE_STATIC);
+            break;
+        case Param::Kind::Blob:
+            status = sqlite3_bind_blob(statement, idx, text,
+                                       static_cast<int>(cur.size), SQLITE_STATIC);
+            break;
+        }
+        check_bind(status, i % m_num_column + 1);
+    }
+    const int status = sqlite3_step(statement);
+    const std::string error =
+        (status == SQLITE_DONE) ? "" : std::string(sqlite3_errmsg(m_db));
+    sqlite3_clear_bindings(statement);
+    sqlite3_reset(statement);
+    // parameters not bound for the next rows are NULL, as after
+    // sqlite3_clear_bindings
+    for (size_t i = 0; i < num_param; ++i) m_params[i] = Param();
+    m_text_buffer.clear();
+    m_num_pending = 0;
+    if (status != SQLITE_DONE)
+    {
+        throw std::runtime_error("Error: Insert failed: " + error + " ("
+                                 + std::to_string(status) + ")");
+    }
 }
 
 
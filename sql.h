@@ -1,7 +1,10 @@
 #ifndef PROCESS_SQL_H
 #define PROCESS_SQL_H
 
+#include "misc.hpp"
+#include <algorithm>
 #include <assert.h>
+#include <initializer_list>
 #include <iostream>
 #include <sqlite3.h>
 #include <stdexcept>
@@ -10,21 +13,207 @@
 class SQL
 {
 public:
+    // How a parameter given as text should be bound. Integer, Real and
+    // Numeric are converted when the text is a number of that kind and are
+    // bound as text otherwise, same as SQLite's column affinity would do.
+    // An empty cell is NULL for all types but Text, where it stays ''
+    // (e.g. the Notes of a coding without any)
+    enum class Type
+    {
+        Integer,
+        Real,
+        Numeric,
+        Text,
+        Blob
+    };
     SQL(const std::string& name, sqlite3* dat);
+    ~SQL();
+    SQL(const SQL&) = delete;
+    SQL& operator=(const SQL&) = delete;
     void create_table(const std::string& sql);
+    // Take over the table if an earlier run already created it, instead of
+    // creating it. Return false if there is no such table
+    bool use_existing();
     void prep_statement(const std::string& sql);
+    // prepare with one type per parameter, used by the run_statement taking
+    // string views
+    void prep_statement(const std::string& sql, const std::vector<Type>& types)
+    {
+        prep_statement(sql);
+        m_types = types;
+    }
+    // Prepare insert (e.g. "INSERT INTO T(A, B)") as a multi-row
+    // INSERT ... VALUES (?,?),(?,?),... with as many rows as the variable
+    // limit of SQLite allows (up to a few hundred), one type per column. Rows are then collected
+    // by run() and written a statement at a time, flush() writes what is left
+    void prep_insert(const std::string& insert, const std::vector<Type>& types);
+    // write rows still waiting for a full multi-row statement
+    void flush();
+    // bind a single parameter, index start from 1
+    void bind(int idx, sqlite3_int64 value)
+    {
+        Param& cur = param(idx);
+        cur.kind = Param::Kind::Integer;
+        cur.int_value = value;
+    }
+    void bind(int idx, double value)
+    {
+        Param& cur = param(idx);
+        cur.kind = Param::Kind::Real;
+        cur.real_value = value;
+    }
+    void bind_null(int idx) { param(idx).kind = Param::Kind::Null; }
+    // A single row statement does not copy text and blob, the data must stay
+    // valid until run(). A multi-row insert keeps its own copy as the row is
+    // only written once the statement is full
+    void bind(int idx, const misc::string_view& value)
+    {
+        set_text(param(idx), Param::Kind::Text, value.data(), value.size());
+    }
+    void bind_blob(int idx, const void* data, size_t size)
+    {
+        set_text(param(idx), Param::Kind::Blob, static_cast<const char*>(data),
+                 size);
+    }
+    // bind text according to type
+    void bind(int idx, const misc::string_view& value, Type type)
+    {
+        if (value.empty() && type != Type::Text)
+        {
+            bind_null(idx);
+            return;
+        }
+        long long int_value;
+        double real_value;
+        switch (type)
+        {
+        case Type::Integer:
+        case Type::Numeric:
+            if (misc::parse_int(value, int_value))
+            {
+                bind(idx, static_cast<sqlite3_int64>(int_value));
+                return;
+            }
+            if (type == Type::Integer) break;
+        // fall through
+        case Type::Real:
+            if (misc::parse_double(value, real_value))
+            {
+                // like NUMERIC affinity, keep 1.0 as an integer
+                if (type == Type::Numeric && std::floor(real_value) == real_value
+                    && std::fabs(real_value) < 9.2e18)
+                { bind(idx, static_cast<sqlite3_int64>(real_value)); }
+                else
+                {
+                    bind(idx, real_value);
+                }
+                return;
+            }
+            break;
+        case Type::Blob:
+            bind_blob(idx, value.data(), value.size());
+            return;
+        case Type::Text: break;
+        }
+        bind(idx, value);
+    }
+    // run the statement with the parameters bound so far. For a multi-row
+    // insert this only adds the row to the statement
+    void run()
+    {
+        if (++m_num_pending == m_rows_per_statement)
+        { execute(m_statement, m_num_pending); }
+    }
+    // number of rows the prepared statement takes at once
+    size_t rows_per_statement() const { return m_rows_per_statement; }
+    // One parameter of a row. Small enough to pass by value, text is only
+    // referenced, so a row can be bound straight from the input buffers
+    class Value
+    {
+    public:
+        Value(sqlite3_int64 value) : m_kind(Kind::Integer), m_int(value) {}
+        Value(double value) : m_kind(Kind::Real), m_real(value) {}
+        Value(const misc::string_view& value, Type type = Type::Text)
+            : m_kind(Kind::View), m_type(type), m_view(value)
+        {
+        }
+        static Value null()
+        {
+            Value value(static_cast<sqlite3_int64>(0));
+            value.m_kind = Kind::Null;
+            return value;
+        }
+        void bind(SQL& sql, int idx) const
+        {
+            switch (m_kind)
+            {
+            case Kind::Integer: sql.bind(idx, m_int); break;
+            case Kind::Real: sql.bind(idx, m_real); break;
+            case Kind::View: sql.bind(idx, m_view, m_type); break;
+            case Kind::Null: sql.bind_null(idx); break;
+            }
+        }
+
+    private:
+        enum class Kind
+        {
+            Integer,
+            Real,
+            View,
+            Null
+        };
+        Kind m_kind;
+        Type m_type = Type::Text;
+        sqlite3_int64 m_int = 0;
+        double m_real = 0;
+        misc::string_view m_view;
+    };
+    // bind a whole row, in parameter order, and insert it
+    void insert(std::initializer_list<Value> row)
+    {
+        int idx = 1;
+        for (auto&& value : row) value.bind(*this, idx++);
+        run();
+    }
     void run_statement(const std::vector<std::string>& token,
                        const size_t range, const size_t begin = 0)
     {
         bind_statement(token, range, begin);
-        process_statement();
+        run();
     }
 
     void run_statement(const std::vector<std::string>& token,
                        const size_t begin = 0)
     {
         bind_statement(token, token.size(), begin);
-        process_statement();
+        run();
+    }
+    void run_statement(const std::vector<misc::string_view>& token,
+                       const size_t range, const size_t begin = 0)
+    {
+        bind_statement(token, range, begin);
+        run();
+    }
+    void run_statement(const std::vector<misc::string_view>& token)
+    {
+        bind_statement(token, token.size());
+        run();
+    }
+    // bind tokens to the parameters by type without running the statement,
+    // so the parameters after them can be bound before run()
+    void bind_statement(const std::vector<misc::string_view>& token,
+                        const size_t range, const size_t begin = 0)
+    {
+        assert(range <= token.size());
+        assert(begin < range);
+        // extra tokens have no column to go to and are dropped
+        const size_t end = std::min(range, begin + m_num_column);
+        for (size_t i = begin; i < end; ++i)
+        {
+            const size_t idx = i - begin;
+            bind(static_cast<int>(idx + 1), token[i],
+                 idx < m_types.size() ? m_types[idx] : Type::Text);
+        }
     }
     void create_index(const std::string& index_name,
                       const std::vector<std::string>& fields);
@@ -46,9 +235,36 @@ public:
     }
 
 private:
+    // a bound parameter waiting for its statement to run
+    struct Param
+    {
+        enum class Kind
+        {
+            Null,
+            Integer,
+            Real,
+            Text,
+            Blob
+        };
+        Kind kind = Kind::Null;
+        sqlite3_int64 int_value = 0;
+        double real_value = 0;
+        // text is either referenced directly or copied to m_text_buffer
+        const char* text = nullptr;
+        size_t offset = 0;
+        size_t size = 0;
+    };
     sqlite3* m_db;
-    sqlite3_stmt* m_statement;
+    sqlite3_stmt* m_statement = nullptr;
     std::string m_table_name;
+    std::string m_insert;
+    std::vector<Type> m_types;
+    // parameters of all rows of the statement, row major
+    std::vector<Param> m_params;
+    std::vector<char> m_text_buffer;
+    size_t m_num_column = 0;
+    size_t m_rows_per_statement = 1;
+    size_t m_num_pending = 0;
     bool m_table_created = false;
     static int callback(void* /*NotUsed*/, int argc, char** argv,
                         char** azColName)
@@ -60,37 +276,56 @@ private:
         return 0;
     }
 
-
-    void process_statement()
+    Param& param(int idx)
+    {
+        if (idx < 1 || static_cast<size_t>(idx) > m_num_column)
+        {
+            throw std::runtime_error("Error: Parameter " + std::to_string(idx)
+                                     + " out of range for " + m_table_name);
+        }
+        return m_params[m_num_pending * m_num_column
+                        + static_cast<size_t>(idx - 1)];
+    }
+    void set_text(Param& cur, Param::Kind kind, const char* data, size_t size)
     {
-        int status = sqlite3_step(m_statement);
-        if (status != SQLITE_DONE || status == SQLITE_ERROR
-            || status == SQLITE_BUSY)
+        cur.kind = kind;
+        cur.size = size;
+        if (m_rows_per_statement == 1) { cur.text = data; }
+        else
         {
-            throw std::runtime_error("Error: Insert failed: "
-                                     + std::string(sqlite3_errmsg(m_db)) + " ("
-                                     + std::to_string(status) + ")");
+            cur.text = nullptr;
+            cur.offset = m_text_buffer.size();
+            m_text_buffer.insert(m_text_buffer.end(), data, data + size);
         }
-        sqlite3_clear_bindings(m_statement);
-        sqlite3_reset(m_statement);
     }
+    // bind the parameters of the first num_row rows to statement and run it
+    void execute(sqlite3_stmt* statement, size_t num_row);
+    std::string insert_sql(size_t num_row) const;
 
     void bind_statement(const std::vector<std::string>& token,
                         const size_t range, const size_t begin = 0)
     {
         assert(range <= token.size());
         assert(begin < range);
-        for (size_t i = begin; i < range; ++i)
-        {
-            sqlite3_bind_text(m_statement, static_cast<int>(i + 1 - begin),
-                              token[i].c_str(), -1, SQLITE_TRANSIENT);
-        }
+        const size_t end = std::min(range, begin + m_num_column);
+        for (size_t i = begin; i < end; ++i)
+        { bind(static_cast<int>(i + 1 - begin), misc::string_view(token[i])); }
     }
     void bind_statement(const std::vector<std::string>& token,
                         const size_t begin = 0)
     {
         bind_statement(token, token.size(), begin);
     }
+    void check_bind(int status, size_t idx)
+    {
+        if (status != SQLITE_OK)
+        {
+            throw std::runtime_error(
+                "Error: Failed to bind parameter " + std::to_string(idx)
+                + " of " + m_table_name + ": "
+                + std::string(sqlite3_errmsg(m_db)));
+        }
+    }
 };
 
 #endif // PROCESS_SQL_H
@@ -0,0 +1,351 @@
+// Write a few fields through ColumnStore and decode the .columns file with
+// the .catalog alone: each chunk is read with a single pread at its offset,
+// inflated, and its missing bitmap and values compared with what went in
+#include "column_store.h"
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include <zlib.h>
+
+namespace
+{
+int failures = 0;
+
+void check(bool ok, const std::string& what)
+{
+    if (ok) return;
+    std::cerr << "FAIL: " << what << std::endl;
+    ++failures;
+}
+
+struct Cell
+{
+    int64_t field;
+    int64_t instance;
+    int64_t array;
+    int64_t id;
+    const char* value;
+    // for encoded fields, the PHENO_META key of the value
+    int64_t key;
+};
+
+// 13 participants, so the bitmap ends in a partial byte
+const std::vector<int64_t> participants = {
+    1000011, 1000022, 1000035, 1000040, 1000057, 1000068, 1000079,
+    1000080, 1000091, 1000102, 1000113, 1000124, 1000135};
+
+// in (field, instance, array, id) order, as the sorter hands them over
+const Cell cells[] = {
+    // categorical codes, one instance with every participant but one
+    {31, 0, 0, 1000011, "0", 0},
+    {31, 0, 0, 1000022, "1", 0},
+    {31, 0, 0, 1000035, "-1", 0},
+    {31, 0, 0, 1000040, "1", 0},
+    {31, 0, 0, 1000057, "0", 0},
+    {31, 0, 0, 1000068, "1", 0},
+    {31, 0, 0, 1000079, "0", 0},
+    {31, 0, 0, 1000080, "1", 0},
+    {31, 0, 0, 1000091, "0", 0},
+    {31, 0, 0, 1000102, "1", 0},
+    {31, 0, 0, 1000113, "0", 0},
+    {31, 0, 0, 1000135, "9223372036854775807", 0},
+    // continuous, whole values stay real
+    {50, 0, 0, 1000022, "186", 0},
+    {50, 0, 0, 1000135, "161.5", 0},
+    {50, 1, 0, 1000011, "-0.25", 0},
+    // integer field with a value that only fits a real
+    {51, 0, 0, 1000040, "12", 0},
+    {51, 0, 0, 1000057, "1e3", 0},
+    // text, with an empty value that is not missing
+    {20001, 0, 0, 1000011, "free text", 0},
+    {20001, 0, 0, 1000068, "", 0},
+    {20001, 0, 0, 1000124, "Treatment 7", 0},
+    {20001, 0, 3, 1000079, "a\tb", 0},
+    // encoded, keys into PHENO_META
+    {41202, 0, 0, 1000035, "K20", 17},
+    {41202, 0, 0, 1000091, "I10", 4},
+    {41202, 0, 1, 1000091, "E11", 123456789012LL}};
+
+struct Entry
+{
+    int64_t field, instance, array;
+    std::string type;
+    uint64_t offset, bytes, rows, missing;
+    std::string name;
+};
+
+std::vector<Entry> read_catalog(const std::string& name)
+{
+    std::vector<Entry> entries;
+    std::ifstream in(name);
+    std::string line;
+    std::getline(in, line);
+    check(line.compare(0, 17, "FieldID\tInstance\t") == 0,
+          "catalog header: " + line);
+    std::vector<misc::string_view> token;
+    while (std::getline(in, line))
+    {
+        misc::split_fields(token, misc::string_view(line), '\t');
+        if (token.size() != 11)
+        {
+            check(false, "catalog line: " + line);
+            continue;
+        }
+        Entry entry;
+        entry.field = std::stoll(token[0].to_string());
+        entry.instance = std::stoll(token[1].to_string());
+        entry.array = std::stoll(token[2].to_string());
+        entry.type = token[3].to_string();
+        entry.offset = std::stoull(token[4].to_string());
+        entry.bytes = std::stoull(token[5].to_string());
+        entry.rows = std::stoull(token[6].to_string());
+        entry.missing = std::stoull(token[7].to_string());
+        entry.name = token[8].to_string();
+        entries.push_back(entry);
+    }
+    return entries;
+}
+
+// one read of the chunk, inflated
+std::vector<char> load_chunk(int fd, const Entry& entry)
+{
+    std::vector<char> compressed(entry.bytes);
+    if (pread(fd, compressed.data(), compressed.size(),
+              static_cast<off_t>(entry.offset))
+        != static_cast<ssize_t>(compressed.size()))
+    {
+        check(false, "read of chunk at " + std::to_string(entry.offset));
+        return std::vector<char>();
+    }
+    std::vector<char> payload(1024);
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    inflateInit(&stream);
+    stream.next_in = reinterpret_cast<Bytef*>(compressed.data());
+    stream.avail_in = static_cast<uInt>(compressed.size());
+    int status = Z_OK;
+    while (status == Z_OK)
+    {
+        if (stream.total_out == payload.size())
+        { payload.resize(2 * payload.size()); }
+        stream.next_out =
+            reinterpret_cast<Bytef*>(payload.data() + stream.total_out);
+        stream.avail_out =
+            static_cast<uInt>(payload.size() - stream.total_out);
+        status = inflate(&stream, Z_NO_FLUSH);
+    }
+    check(status == Z_STREAM_END && stream.avail_in == 0,
+          "chunk at " + std::to_string(entry.offset) + " inflates");
+    payload.resize(stream.total_out);
+    inflateEnd(&stream);
+    return payload;
+}
+
+template <typename T> T get(const std::vector<char>& payload, size_t pos)
+{
+    T value;
+    memcpy(&value, payload.data() + pos, sizeof(T));
+    return value;
+}
+
+// the type ColumnStore should pick for the cells of one chunk
+std::string expected_type(const std::vector<const Cell*>& chunk,
+                          const FieldCatalog& catalog)
+{
+    if (chunk.front()->key != 0) return "Key";
+    bool integer = catalog.type(chunk.front()->field) != ValueType::Continuous,
+         real = true;
+    for (auto&& cell : chunk)
+    {
+        long long int_value;
+        double real_value;
+        const misc::string_view value(cell->value, strlen(cell->value));
+        integer = integer && misc::parse_int(value, int_value);
+        real = real && misc::parse_double(value, real_value);
+    }
+    return integer ? "Integer" : (real ? "Real" : "Text");
+}
+
+void check_chunk(const Entry& entry, const std::vector<char>& payload,
+                 const std::vector<const Cell*>& chunk,
+                 const FieldCatalog& catalog)
+{
+    const std::string where = "chunk " + std::to_string(entry.field) + "-"
+                              + std::to_string(entry.instance) + "."
+                              + std::to_string(entry.array);
+    const size_t num_row = participants.size();
+    const size_t bitmap_size = (num_row + 7) / 8;
+    check(entry.type == expected_type(chunk, catalog),
+          where + " has type " + entry.type);
+    check(entry.rows == num_row, where + " rows");
+    check(entry.missing == num_row - chunk.size(), where + " missing count");
+    std::vector<const Cell*> by_row(num_row, nullptr);
+    for (auto&& cell : chunk)
+    {
+        for (size_t row = 0; row < num_row; ++row)
+        {
+            if (participants[row] == cell->id) by_row[row] = cell;
+        }
+    }
+    const size_t value_size =
+        entry.type == "Text" ? (num_row + 1) * 8 : num_row * 8;
+    if (payload.size() < bitmap_size + value_size)
+    {
+        check(false, where + " is too short");
+        return;
+    }
+    for (size_t row = 0; row < num_row; ++row)
+    {
+        const bool missing = (payload[row / 8] >> (row % 8)) & 1;
+        check(missing == (by_row[row] == nullptr),
+              where + " bitmap of row " + std::to_string(row));
+    }
+    // the padding bits of the last byte are set, as missing
+    for (size_t bit = num_row; bit < bitmap_size * 8; ++bit)
+    { check((payload[bit / 8] >> (bit % 8)) & 1, where + " padding bit"); }
+    if (entry.type == "Text")
+    {
+        const size_t text_begin = bitmap_size + value_size;
+        check(get<uint64_t>(payload, bitmap_size + num_row * 8)
+                  == payload.size() - text_begin,
+              where + " last offset is the text size");
+        for (size_t row = 0; row < num_row; ++row)
+        {
+            const size_t pos = bitmap_size + row * 8;
+            const uint64_t begin = get<uint64_t>(payload, pos),
+                           end = get<uint64_t>(payload, pos + 8);
+            const std::string text(payload.data() + text_begin + begin,
+                                   end - begin);
+            check(text == (by_row[row] ? by_row[row]->value : ""),
+                  where + " text of row " + std::to_string(row) + ": "
+                      + text);
+        }
+        return;
+    }
+    check(payload.size() == bitmap_size + value_size, where + " size");
+    for (size_t row = 0; row < num_row; ++row)
+    {
+        const size_t pos = bitmap_size + row * 8;
+        const Cell* cell = by_row[row];
+        bool same;
+        if (entry.type == "Real")
+        {
+            const double expected = cell ? strtod(cell->value, nullptr) : 0;
+            same = get<double>(payload, pos) == expected;
+        }
+        else if (entry.type == "Key")
+        {
+            same = get<int64_t>(payload, pos) == (cell ? cell->key : 0);
+        }
+        else
+        {
+            same = get<int64_t>(payload, pos)
+                   == (cell ? std::stoll(cell->value) : 0);
+        }
+        check(same, where + " value of row " + std::to_string(row));
+    }
+}
+}
+
+int main()
+{
+    char dir[] = "/tmp/column_store_testXXXXXX";
+    if (mkdtemp(dir) == nullptr) return 1;
+    const std::string prefix = std::string(dir) + "/pheno";
+    FieldCatalog catalog;
+    catalog.set(31, ValueType::CategoricalSingle);
+    catalog.set(50, ValueType::Continuous);
+    catalog.set(51, ValueType::Integer);
+    catalog.set(20001, ValueType::Text);
+    catalog.set(41202, ValueType::CategoricalMultiple);
+    sqlite3* db = nullptr;
+    sqlite3_open(":memory:", &db);
+    sqlite3_exec(db,
+                 "CREATE TABLE DATA_META(FieldID INT, Field TEXT, "
+                 "ValueType TEXT, Coding INT);"
+                 "INSERT INTO DATA_META VALUES(31, 'Sex', "
+                 "'Categorical single', 9);",
+                 nullptr, nullptr, nullptr);
+    // what went in, by chunk
+    std::map<std::vector<int64_t>, std::vector<const Cell*>> chunks;
+    {
+        ColumnStore store(prefix, catalog);
+        store.start(participants);
+        for (auto&& cell : cells)
+        {
+            EavRecord record;
+            record.field = cell.field;
+            record.instance = cell.instance;
+            record.array = cell.array;
+            record.id = cell.id;
+            record.encoded = cell.key != 0;
+            record.key = cell.key;
+            record.value = misc::string_view(cell.value, strlen(cell.value));
+            store.add(record);
+            chunks[{cell.field, cell.instance, cell.array}].push_back(&cell);
+        }
+        store.finish();
+        store.write_catalog(db);
+    }
+    sqlite3_close(db);
+    const std::vector<Entry> entries = read_catalog(prefix + ".catalog");
+    check(entries.size() == chunks.size() + 1,
+          "one catalog line per chunk and the participants");
+    const int fd = open((prefix + ".columns").c_str(), O_RDONLY);
+    char magic[8] = {0};
+    check(pread(fd, magic, sizeof(magic), 0) == 8
+              && memcmp(magic, "UKBCOL1\n", 8) == 0,
+          "magic");
+    // chunks follow each other from the magic to the end of the file
+    uint64_t next = sizeof(magic);
+    for (auto&& entry : entries)
+    {
+        check(entry.offset == next, "chunks are contiguous");
+        next = entry.offset + entry.bytes;
+        const std::vector<char> payload = load_chunk(fd, entry);
+        if (entry.field == 0)
+        {
+            check(entry.type == "Integer" && entry.missing == 0
+                      && entry.name == "eid",
+                  "participant chunk in the catalog");
+            const size_t bitmap_size = (participants.size() + 7) / 8;
+            check(payload.size() == bitmap_size + participants.size() * 8,
+                  "participant chunk size");
+            if (payload.size() != bitmap_size + participants.size() * 8)
+                continue;
+            for (size_t row = 0; row < participants.size(); ++row)
+            {
+                check(!((payload[row / 8] >> (row % 8)) & 1),
+                      "participant bitmap");
+                check(get<int64_t>(payload, bitmap_size + row * 8)
+                          == participants[row],
+                      "participant ID of row " + std::to_string(row));
+            }
+            continue;
+        }
+        auto&& chunk = chunks.find({entry.field, entry.instance, entry.array});
+        if (chunk == chunks.end())
+        {
+            check(false, "unexpected chunk of field "
+                             + std::to_string(entry.field));
+            continue;
+        }
+        check_chunk(entry, payload, chunk->second, catalog);
+        check(entry.field != 31 || entry.name == "Sex",
+              "field name from DATA_META");
+    }
+    check(static_cast<off_t>(next) == lseek(fd, 0, SEEK_END),
+          "last chunk ends the file");
+    close(fd);
+    unlink((prefix + ".columns").c_str());
+    unlink((prefix + ".catalog").c_str());
+    rmdir(dir);
+    if (failures != 0) return 1;
+    std::cerr << "All column chunks decode" << std::endl;
+    return 0;
+}
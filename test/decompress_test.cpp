@@ -0,0 +1,123 @@
+// Files written by recompress must read back byte for byte through the
+// threaded Decompressor, including an empty file and sizes where the empty
+// end of file block is alone in the last job handed to a worker
+#include "recompress.h"
+#include <cstdio>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+int failures = 0;
+
+// BGZF input block written by recompress, and the decompressed size at which
+// the decompressor hands a job to a worker
+const size_t block_size = 65280;
+const size_t job_output = 4 * 1024 * 1024;
+
+std::vector<char> make_input(size_t size)
+{
+    // tab delimited lines, compressible like the real thing
+    std::vector<char> data;
+    data.reserve(size);
+    for (size_t line = 0; data.size() < size; ++line)
+    {
+        const std::string text = std::to_string(1000000 + line % 9000000)
+                                 + "\t2\t01/02/2003\tC10..\t"
+                                 + std::to_string(line * 7919 % 1000) + "\n";
+        data.insert(data.end(), text.begin(), text.end());
+    }
+    data.resize(size);
+    return data;
+}
+
+std::vector<char> read_back(const std::string& name, size_t num_thread,
+                            Decompressor::Format& format)
+{
+    const int fd = open(name.c_str(), O_RDONLY);
+    if (fd == -1) throw std::runtime_error("Error: Cannot open " + name);
+    // peek as LineSource does, a seek table is only looked for when the
+    // decompressor reads the file from its start
+    char magic[Decompressor::magic_size];
+    const ssize_t num_magic = pread(fd, magic, sizeof(magic), 0);
+    std::vector<char> data;
+    {
+        Decompressor decompressor(
+            fd,
+            Decompressor::detect(
+                magic, num_magic < 0 ? 0 : static_cast<size_t>(num_magic)),
+            std::vector<char>(), num_thread);
+        format = decompressor.format();
+        char buffer[100000];
+        size_t num_read;
+        while ((num_read = decompressor.read(buffer, sizeof(buffer))) != 0)
+        { data.insert(data.end(), buffer, buffer + num_read); }
+    }
+    close(fd);
+    return data;
+}
+
+void round_trip(size_t size, Decompressor::Format format,
+                const std::string& dir)
+{
+    const std::string plain = dir + "/plain", packed = dir + "/packed";
+    const std::vector<char> input = make_input(size);
+    FILE* out = fopen(plain.c_str(), "wb");
+    fwrite(input.data(), 1, input.size(), out);
+    fclose(out);
+    const std::string label = std::string(Decompressor::name(format)) + " of "
+                              + std::to_string(size) + " bytes";
+    try
+    {
+        recompress(plain, packed, format, 6, 3);
+        Decompressor::Format found;
+        const std::vector<char> output = read_back(packed, 3, found);
+        if (found != format)
+        {
+            fprintf(stderr, "FAIL: %s read back as %s\n", label.c_str(),
+                    Decompressor::name(found));
+            ++failures;
+        }
+        if (output != input)
+        {
+            fprintf(stderr, "FAIL: %s read back as %zu different bytes\n",
+                    label.c_str(), output.size());
+            ++failures;
+        }
+    }
+    catch (const std::runtime_error& error)
+    {
+        fprintf(stderr, "FAIL: %s: %s\n", label.c_str(), error.what());
+        ++failures;
+    }
+    remove(plain.c_str());
+    remove(packed.c_str());
+}
+}
+
+int main()
+{
+    char dir[] = "/tmp/decompress_testXXXXXX";
+    if (mkdtemp(dir) == nullptr) return 1;
+    std::vector<Decompressor::Format> formats = {Decompressor::Format::Bgzf};
+#ifdef UKB_WITH_ZSTD
+    formats.push_back(Decompressor::Format::SeekableZstd);
+#endif
+    // the 65th full block takes a job past its output size, leaving the end
+    // of file block for a job of its own
+    const size_t full_job = (job_output / block_size + 1) * block_size;
+    for (auto&& format : formats)
+    {
+        for (size_t size : {size_t(0), size_t(1), block_size - 1, block_size,
+                            block_size + 1, full_job - 1, full_job,
+                            full_job + 1, 2 * full_job})
+        { round_trip(size, format, dir); }
+    }
+    rmdir(dir);
+    if (failures != 0) return 1;
+    fprintf(stderr, "All files read back\n");
+    return 0;
+}
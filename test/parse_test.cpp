@@ -0,0 +1,232 @@
+// Edge cases of misc::read_int and misc::read_double: overflow, trailing
+// garbage, subnormals and rounding on both sides of the boundary between the
+// exact fast path and the strtod fallback
+#include "misc.hpp"
+#include <cfloat>
+#include <clocale>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+
+namespace
+{
+int failures = 0;
+
+const char* status_name(misc::ParseStatus status)
+{
+    switch (status)
+    {
+    case misc::ParseStatus::Ok: return "Ok";
+    case misc::ParseStatus::Invalid: return "Invalid";
+    case misc::ParseStatus::OutOfRange: return "OutOfRange";
+    }
+    return "?";
+}
+
+void check_int(const std::string& text, misc::ParseStatus expected,
+               long long expected_value = 0)
+{
+    long long value = 0;
+    const misc::ParseStatus status =
+        misc::read_int(misc::string_view(text), value);
+    if (status != expected
+        || (status == misc::ParseStatus::Ok && value != expected_value))
+    {
+        fprintf(stderr, "FAIL: read_int(\"%s\") gave %s %lld\n", text.c_str(),
+                status_name(status), value);
+        ++failures;
+    }
+}
+
+bool same_bits(double a, double b) { return std::memcmp(&a, &b, 8) == 0; }
+
+void check_double(const std::string& text, misc::ParseStatus expected,
+                  double expected_value = 0)
+{
+    double value = 0;
+    const misc::ParseStatus status =
+        misc::read_double(misc::string_view(text), value);
+    if (status != expected
+        || (status == misc::ParseStatus::Ok
+            && !same_bits(value, expected_value)))
+    {
+        fprintf(stderr, "FAIL: read_double(\"%s\") gave %s %.17g\n",
+                text.c_str(), status_name(status), value);
+        ++failures;
+    }
+}
+
+template <typename T> void check_throws(const std::string& text)
+{
+    try
+    {
+        misc::convert<T>(text);
+    }
+    catch (const std::runtime_error&)
+    {
+        return;
+    }
+    fprintf(stderr, "FAIL: convert(\"%s\") did not throw\n", text.c_str());
+    ++failures;
+}
+
+void integers()
+{
+    using misc::ParseStatus;
+    check_int("0", ParseStatus::Ok, 0);
+    check_int("-0", ParseStatus::Ok, 0);
+    check_int("+42", ParseStatus::Ok, 42);
+    check_int("1000001", ParseStatus::Ok, 1000001);
+    // 18 digits are read without the overflow check, 19 with it
+    check_int("999999999999999999", ParseStatus::Ok, 999999999999999999LL);
+    check_int("9223372036854775807", ParseStatus::Ok, INT64_MAX);
+    check_int("-9223372036854775808", ParseStatus::Ok, INT64_MIN);
+    check_int("9223372036854775808", ParseStatus::OutOfRange);
+    check_int("-9223372036854775809", ParseStatus::OutOfRange);
+    check_int("99999999999999999999", ParseStatus::OutOfRange);
+    check_int("000000000000000000000000042", ParseStatus::Ok, 42);
+    check_int("", ParseStatus::Invalid);
+    check_int("-", ParseStatus::Invalid);
+    check_int("12a", ParseStatus::Invalid);
+    check_int("1 ", ParseStatus::Invalid);
+    check_int(" 1", ParseStatus::Invalid);
+    check_int("1.0", ParseStatus::Invalid);
+    check_int("0x10", ParseStatus::Invalid);
+    check_int("NA", ParseStatus::Invalid);
+    // a letter after 19 digits is still garbage, not an overflow
+    check_int("1234567890123456789x", ParseStatus::Invalid);
+    check_throws<int>("2147483648");
+    check_throws<int>("12abc");
+    check_throws<unsigned>("-1");
+    if (misc::convert<int>("-2147483648") != INT32_MIN)
+    {
+        fprintf(stderr, "FAIL: convert<int>(\"-2147483648\")\n");
+        ++failures;
+    }
+}
+
+void doubles()
+{
+    using misc::ParseStatus;
+    check_double("0", ParseStatus::Ok, 0.0);
+    check_double("-0", ParseStatus::Ok, -0.0);
+    check_double("-0.0e10", ParseStatus::Ok, -0.0);
+    check_double("1.5", ParseStatus::Ok, 1.5);
+    check_double("+.5", ParseStatus::Ok, 0.5);
+    check_double("5.", ParseStatus::Ok, 5.0);
+    check_double("-23.4521", ParseStatus::Ok, -23.4521);
+    check_double("1E3", ParseStatus::Ok, 1000.0);
+    check_double("", ParseStatus::Invalid);
+    check_double(".", ParseStatus::Invalid);
+    check_double("-", ParseStatus::Invalid);
+    check_double("1e", ParseStatus::Invalid);
+    check_double("1e+", ParseStatus::Invalid);
+    check_double("1.5x", ParseStatus::Invalid);
+    check_double("1.2.3", ParseStatus::Invalid);
+    check_double("1,5", ParseStatus::Invalid);
+    check_double(" 1", ParseStatus::Invalid);
+    check_double("inf", ParseStatus::Invalid);
+    check_double("nan", ParseStatus::Invalid);
+    check_double("0x1p3", ParseStatus::Invalid);
+    check_double("NA", ParseStatus::Invalid);
+    // range
+    check_double("1.7976931348623157e308", ParseStatus::Ok, DBL_MAX);
+    check_double("1e309", ParseStatus::OutOfRange);
+    check_double("-1e309", ParseStatus::OutOfRange);
+    check_double("1e99999999999", ParseStatus::OutOfRange);
+    check_double("1e-99999999999", ParseStatus::Ok, 0.0);
+    check_double("1e-400", ParseStatus::Ok, 0.0);
+    // subnormals
+    check_double("2.2250738585072014e-308", ParseStatus::Ok, DBL_MIN);
+    check_double("2.2250738585072011e-308", ParseStatus::Ok,
+                 2.2250738585072011e-308);
+    check_double("4.9406564584124654e-324", ParseStatus::Ok,
+                 std::numeric_limits<double>::denorm_min());
+    check_double("2.4703282292062328e-324", ParseStatus::Ok,
+                 std::numeric_limits<double>::denorm_min());
+    check_double("2.4703282292062327e-324", ParseStatus::Ok, 0.0);
+    // the fast path takes mantissas up to 2^53 and powers of ten up to 22
+    check_double("9007199254740992", ParseStatus::Ok, 9007199254740992.0);
+    check_double("9007199254740993", ParseStatus::Ok, 9007199254740992.0);
+    check_double("9007199254740995", ParseStatus::Ok, 9007199254740996.0);
+    check_double("1e22", ParseStatus::Ok, 1e22);
+    check_double("1e23", ParseStatus::Ok, 1e23);
+    check_double("1e-22", ParseStatus::Ok, 1e-22);
+    check_double("1e-23", ParseStatus::Ok, 1e-23);
+    check_double("9007199254740991e22", ParseStatus::Ok,
+                 9007199254740991e22);
+    check_double("9007199254740991e-22", ParseStatus::Ok,
+                 9007199254740991e-22);
+    check_double("0.1", ParseStatus::Ok, 0.1);
+    check_double("0.30000000000000004", ParseStatus::Ok,
+                 0.30000000000000004);
+    // more than 19 significant digits, halfway between two doubles and
+    // just above it
+    check_double("1.00000000000000011102230246251565404236316680908203125",
+                 ParseStatus::Ok, 1.0);
+    check_double("1.00000000000000011102230246251565404236316680908203126",
+                 ParseStatus::Ok, 1.0000000000000002);
+    check_double("123456789012345678901234567890", ParseStatus::Ok,
+                 123456789012345678901234567890.0);
+    check_double("0.000000000000000000000000000000000000001234",
+                 ParseStatus::Ok, 1.234e-39);
+    check_throws<double>("1e309");
+    check_throws<double>("abc");
+}
+
+// Random doubles printed with 17 digits must read back bit for bit, and
+// shorter random decimals must match strtod
+void random_numbers()
+{
+    std::mt19937_64 rng(20190101);
+    char text[64];
+    for (size_t i = 0; i < 200000; ++i)
+    {
+        uint64_t bits = rng();
+        double x;
+        std::memcpy(&x, &bits, 8);
+        if (!std::isfinite(x)) continue;
+        snprintf(text, sizeof(text), "%.17g", x);
+        check_double(text, misc::ParseStatus::Ok, x);
+    }
+    std::uniform_int_distribution<int> digits(1, 25), exponent(-30, 30);
+    for (size_t i = 0; i < 200000; ++i)
+    {
+        std::string number;
+        const int num_digit = digits(rng);
+        const int point = static_cast<int>(rng() % (num_digit + 1));
+        for (int d = 0; d < num_digit; ++d)
+        {
+            if (d == point) number += '.';
+            number += static_cast<char>('0' + rng() % 10);
+        }
+        if (number == ".") number = "0";
+        if (rng() % 2) number += "e" + std::to_string(exponent(rng));
+        check_double(number, misc::ParseStatus::Ok,
+                     strtod(number.c_str(), nullptr));
+    }
+}
+}
+
+int main()
+{
+    integers();
+    doubles();
+    random_numbers();
+    // the decimal point of the locale must not matter
+    if (setlocale(LC_NUMERIC, "de_DE.UTF-8") != nullptr)
+    {
+        double value = 0;
+        misc::read_double(misc::string_view(std::string("1e23")), value);
+        if (!same_bits(value, 1e23) || misc::convert<double>("0.5") != 0.5)
+        {
+            fprintf(stderr, "FAIL: parsing depends on the locale\n");
+            ++failures;
+        }
+        setlocale(LC_NUMERIC, "C");
+    }
+    if (failures != 0) return 1;
+    fprintf(stderr, "All parser checks passed\n");
+    return 0;
+}
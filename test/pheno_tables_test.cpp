@@ -0,0 +1,135 @@
+// The typed layout keeps the values of a field in the table of its type,
+// with PHENOTYPE as a view over them. Queries on that view must give the same
+// answers as on the single PHENOTYPE table of the default layout
+#include "pheno_tables.h"
+#include <iostream>
+#include <sqlite3.h>
+#include <string>
+#include <vector>
+
+namespace
+{
+int failures = 0;
+
+struct Entry
+{
+    sqlite3_int64 id;
+    sqlite3_int64 field;
+    ValueType type;
+    const char* value;
+};
+
+// a categorical field with integer and text codes, a continuous, an integer,
+// a text and a date field
+const Entry entries[] = {
+    {1, 30, ValueType::CategoricalSingle, "1"},
+    {2, 30, ValueType::CategoricalSingle, "1"},
+    {3, 30, ValueType::CategoricalSingle, "2"},
+    {4, 30, ValueType::CategoricalSingle, "-1"},
+    {5, 30, ValueType::CategoricalSingle, "A01"},
+    {1, 41, ValueType::CategoricalMultiple, "1234"},
+    {2, 41, ValueType::CategoricalMultiple, "K20"},
+    {1, 50, ValueType::Continuous, "186"},
+    {2, 50, ValueType::Continuous, "161.5"},
+    {3, 50, ValueType::Continuous, "12"},
+    {4, 50, ValueType::Continuous, "1e2"},
+    {1, 31, ValueType::Integer, "0"},
+    {2, 31, ValueType::Integer, "1"},
+    {3, 31, ValueType::Integer, "1"},
+    {1, 20001, ValueType::Text, "free text"},
+    {2, 20001, ValueType::Text, "Treatment 7"},
+    {1, 53, ValueType::Date, "2010-01-01"},
+    {2, 53, ValueType::Date, "2012-06-30"}};
+
+// A unary + drops the affinity of Pheno, as happens when SQLite does not push
+// the condition down into each table of the view. Then only values stored as
+// numbers compare equal to a number
+const char* queries[] = {
+    "SELECT ID FROM PHENOTYPE WHERE FieldID = 30 AND Pheno = 1",
+    "SELECT ID FROM PHENOTYPE WHERE FieldID = 30 AND +Pheno = 1",
+    "SELECT ID FROM PHENOTYPE WHERE FieldID = 30 AND +Pheno > 1",
+    "SELECT ID FROM PHENOTYPE WHERE FieldID = 41 AND +Pheno = 1234",
+    "SELECT ID FROM PHENOTYPE WHERE FieldID = 50 AND +Pheno > 150",
+    "SELECT ID FROM PHENOTYPE WHERE FieldID = 30 AND Pheno = '1'",
+    "SELECT ID FROM PHENOTYPE WHERE FieldID = 30 AND Pheno IN (1, 2)",
+    "SELECT ID FROM PHENOTYPE WHERE FieldID = 30 AND Pheno < 0",
+    "SELECT ID FROM PHENOTYPE WHERE FieldID = 30 AND Pheno = 'A01'",
+    "SELECT ID FROM PHENOTYPE WHERE FieldID = 41 AND Pheno = 1234",
+    "SELECT ID FROM PHENOTYPE WHERE FieldID = 41 AND Pheno = 'K20'",
+    "SELECT ID FROM PHENOTYPE WHERE FieldID = 50 AND Pheno > 150",
+    "SELECT ID FROM PHENOTYPE WHERE FieldID = 50 "
+    "AND Pheno BETWEEN 12 AND 100",
+    "SELECT ID FROM PHENOTYPE WHERE FieldID = 50 AND Pheno = 186",
+    "SELECT ID FROM PHENOTYPE WHERE FieldID = 31 AND Pheno = 1",
+    "SELECT ID FROM PHENOTYPE WHERE FieldID = 20001 AND Pheno LIKE 'free%'",
+    "SELECT ID FROM PHENOTYPE WHERE FieldID = 53 "
+    "AND Pheno BETWEEN '2010-01-01' AND '2011-01-01'",
+    "SELECT ID FROM PHENOTYPE WHERE Pheno = 1"};
+
+sqlite3* load(const bool typed)
+{
+    sqlite3* db = nullptr;
+    sqlite3_open(":memory:", &db);
+    PhenoTables phenotype(db, typed, false);
+    phenotype.prepare(false);
+    for (auto&& entry : entries)
+    {
+        const std::string text = entry.value;
+        const misc::string_view value(text);
+        const PhenoTables::Storage storage =
+            phenotype.route(PhenoTables::storage(entry.type, false),
+                            entry.type, value);
+        phenotype.insert(storage, SQL::Value(entry.id), 0, entry.field, 0,
+                         SQL::Value(value, phenotype.bind_type(storage)));
+    }
+    phenotype.flush();
+    return db;
+}
+
+std::vector<sqlite3_int64> select_ids(sqlite3* db, const std::string& sql)
+{
+    std::vector<sqlite3_int64> ids;
+    sqlite3_stmt* statement = nullptr;
+    if (sqlite3_prepare_v2(db, (sql + " ORDER BY ID").c_str(), -1,
+                           &statement, nullptr)
+        != SQLITE_OK)
+    {
+        std::cerr << "FAIL: " << sql << ": " << sqlite3_errmsg(db)
+                  << std::endl;
+        ++failures;
+    }
+    while (sqlite3_step(statement) == SQLITE_ROW)
+    { ids.push_back(sqlite3_column_int64(statement, 0)); }
+    sqlite3_finalize(statement);
+    return ids;
+}
+}
+
+int main()
+{
+    sqlite3* untyped = load(false);
+    sqlite3* typed = load(true);
+    for (auto&& query : queries)
+    {
+        const std::vector<sqlite3_int64> expected = select_ids(untyped, query);
+        const std::vector<sqlite3_int64> found = select_ids(typed, query);
+        if (expected.empty())
+        {
+            std::cerr << "FAIL: no rows in the untyped layout: " << query
+                      << std::endl;
+            ++failures;
+        }
+        if (found != expected)
+        {
+            std::cerr << "FAIL: " << query << ": " << found.size()
+                      << " row(s) in the typed layout, " << expected.size()
+                      << " in the untyped one" << std::endl;
+            ++failures;
+        }
+    }
+    sqlite3_close(untyped);
+    sqlite3_close(typed);
+    if (failures != 0) return 1;
+    std::cerr << "All queries agree" << std::endl;
+    return 0;
+}
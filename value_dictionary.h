@@ -0,0 +1,117 @@
+#ifndef PROCESS_VALUE_DICTIONARY_H
+#define PROCESS_VALUE_DICTIONARY_H
+
+#include "misc.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Give each distinct (field, value) pair an integer key, counting up from 1 in
+// the order the pairs are first seen. Keys live in one flat open addressing
+// table keyed on the integer field ID and the hash of the value; the value
+// text is copied once into a shared buffer, so a lookup of a known value does
+// not allocate
+class ValueDictionary
+{
+public:
+    ValueDictionary() { m_slots.resize(1024); }
+    // Find the key of value within field. Return true if the pair was not seen
+    // before and was given a new key
+    bool find_or_insert(int64_t field, const misc::string_view& value,
+                        int64_t& key)
+    {
+        const uint64_t hash = hash_of(field, value);
+        const size_t mask = m_slots.size() - 1;
+        size_t idx = static_cast<size_t>(hash) & mask;
+        while (m_slots[idx].key != 0)
+        {
+            const Slot& slot = m_slots[idx];
+            if (slot.hash == hash && slot.field == field
+                && slot.size == value.size()
+                && (value.empty()
+                    || memcmp(m_text.data() + slot.offset, value.data(),
+                              value.size())
+                           == 0))
+            {
+                key = slot.key;
+                return false;
+            }
+            idx = (idx + 1) & mask;
+        }
+        key = ++m_num_key;
+        Slot& slot = m_slots[idx];
+        slot.hash = hash;
+        slot.field = field;
+        slot.key = key;
+        slot.offset = m_text.size();
+        slot.size = value.size();
+        m_text.insert(m_text.end(), value.begin(), value.end());
+        // keep the table at most half full so probes stay short
+        if (2 * static_cast<size_t>(m_num_key) > m_slots.size()) grow();
+        return true;
+    }
+    // Add a pair with the key an earlier run gave it, new keys then count up
+    // from the largest key seen
+    void restore(int64_t field, const misc::string_view& value, int64_t key)
+    {
+        int64_t found;
+        const int64_t num_key = m_num_key;
+        if (!find_or_insert(field, value, found)) return;
+        // find_or_insert placed it under the next key, relabel it
+        const uint64_t hash = hash_of(field, value);
+        const size_t mask = m_slots.size() - 1;
+        size_t idx = static_cast<size_t>(hash) & mask;
+        while (m_slots[idx].key != found) idx = (idx + 1) & mask;
+        m_slots[idx].key = key;
+        m_num_key = std::max(num_key, key);
+        ++m_num_restored;
+    }
+    size_t size() const
+    {
+        return static_cast<size_t>(m_num_key) - m_num_restored;
+    }
+
+private:
+    struct Slot
+    {
+        uint64_t hash = 0;
+        int64_t field = 0;
+        // 0 marks an empty slot
+        int64_t key = 0;
+        size_t offset = 0;
+        size_t size = 0;
+    };
+    std::vector<Slot> m_slots;
+    std::vector<char> m_text;
+    int64_t m_num_key = 0;
+    // pairs from an earlier run, not counted by size()
+    size_t m_num_restored = 0;
+    static uint64_t hash_of(int64_t field, const misc::string_view& value)
+    {
+        // FNV-1a over the value, seeded with the field
+        uint64_t hash = 14695981039346656037ULL ^ static_cast<uint64_t>(field);
+        for (auto&& c : value)
+        {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 1099511628211ULL;
+        }
+        // the table is indexed by the low bits, fold the high bits into them
+        return hash ^ (hash >> 29);
+    }
+    void grow()
+    {
+        std::vector<Slot> slots(m_slots.size() * 2);
+        const size_t mask = slots.size() - 1;
+        for (auto&& slot : m_slots)
+        {
+            if (slot.key == 0) continue;
+            size_t idx = static_cast<size_t>(slot.hash) & mask;
+            while (slots[idx].key != 0) idx = (idx + 1) & mask;
+            slots[idx] = slot;
+        }
+        m_slots.swap(slots);
+    }
+};
+
+#endif // PROCESS_VALUE_DICTIONARY_H